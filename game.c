@@ -60,9 +60,15 @@ const int MODIFIER_NONE = 0;
 #define MODIFIER_SPIKES 8
 
 
-const int MODIFIER_OFFSET = 10;
 
 float worldOffset = 0.0f;
+// camera scroll in pixels before the last tick, and interpolated for the frame being drawn
+float previousScroll = 0.0f;
+float drawScroll = 0.0f;
+
+float getScroll(){
+    return depth * 32 + worldOffset;
+}
 
 //------------------------------------------------------------------------------------
 // Sounds
@@ -76,12 +82,12 @@ Sound buySound;
 Music music;
 
 void loadSounds(){
-    breakSound = LoadSound("resources/break.wav");
-    mineSound = LoadSound("resources/mine.wav");
-    oreMineSound = LoadSound("resources/oreMine.wav");
-    jumpSound = LoadSound("resources/jump.wav");
-    engineSound = LoadSound("resources/engine.wav");
-    buySound = LoadSound("resources/powerUp.wav");
+    fLoadSound(&breakSound, "resources/break.wav");
+    fLoadSound(&mineSound, "resources/mine.wav");
+    fLoadSound(&oreMineSound, "resources/oreMine.wav");
+    fLoadSound(&jumpSound, "resources/jump.wav");
+    fLoadSound(&engineSound, "resources/engine.wav");
+    fLoadSound(&buySound, "resources/powerUp.wav");
     music = LoadMusicStream("resources/music.mp3");
 }
 
@@ -112,14 +118,13 @@ typedef struct TextPopup TextPopup;
 
 TextPopup popups[MAX_POPUPS];
 
-void updatePopups(){
+void tickPopups(){
     for (int i = 0; i < MAX_POPUPS; i++){
         TextPopup* p = &popups[i];
 
         if (p->exists){
             p->y -= 1;
             p->lifeTime--;
-            drawFancyText(p->text, p->x, p->y, 1, p->c);
             if (p->lifeTime == 0){
                 p->exists = false;
             }
@@ -127,14 +132,27 @@ void updatePopups(){
     }
 }
 
+void drawPopups(){
+    for (int i = 0; i < MAX_POPUPS; i++){
+        TextPopup* p = &popups[i];
+
+        if (p->exists){
+            drawFancyText(p->text, p->x, p->y, 1, p->c);
+        }
+    }
+}
+
 int nextPopupIndex = 0;
-void initPopup(int x, int y, char text[TEXT_POPUP_LENGTH], Color c){
+// spectators are sent the popups created since the last tick
+int popupsCreated = 0;
+void initPopup(int x, int y, const char text[TEXT_POPUP_LENGTH], Color c){
     TextPopup p = {
         .x = x, .y = y, .exists = true, .lifeTime = 45, .c = c
     };
     strcpy(p.text, text);
 
     popups[nextPopupIndex] = p;
+    popupsCreated++;
     nextPopupIndex++;
     nextPopupIndex %= MAX_POPUPS;
 }
@@ -149,7 +167,18 @@ bool isShopOpen = false;
 bool shopInteracted = false;
 int selectedShopSlot = 0;
 
-int itemLevels[] = {0, 0, 0};
+#define SHOP_SLOT_DRILL 0
+#define SHOP_SLOT_FUEL 1
+#define SHOP_SLOT_HULL 2
+#define SHOP_SLOT_SCANNER 3
+#define SHOP_SLOT_CHARGES 4
+#define SHOP_SLOT_LANTERN 5
+#define SHOP_ITEM_SLOTS 6
+#define SHOP_SLOT_EXIT SHOP_ITEM_SLOTS
+#define SHOP_SLOTS (SHOP_ITEM_SLOTS + 1)
+
+int itemLevels[SHOP_ITEM_SLOTS] = {0};
+const int shopSlotSprites[SHOP_SLOTS] = {37, 38, 39, 13, 18, 30, 40};
 const int costMultiplier = 64;
 void activateSlot();
 char displayText[10];
@@ -158,42 +187,45 @@ int calculatePrice(int slot){
     return itemLevels[slot] * costMultiplier + 100;
 }
 
-void updateShop(){
-    draw(36, shopX, shopY - worldOffset - (depth * 32));
+void drawShop(){
+    draw(36, shopX, shopY - drawScroll);
     if (shopInteracted == false){
-        drawFancyText("SHOP", shopX + 4, shopY - 16 - worldOffset - (depth * 32), 10, GOLD);
+        drawFancyText("SHOP", shopX + 4, shopY - 16 - drawScroll, 10, GOLD);
     }
 
 
 
     if (isShopOpen){
-        for (int i = 0; i < 4; i++){
+        for (int i = 0; i < SHOP_SLOTS; i++){
             Color c = GRAY;
             if (i == selectedShopSlot){
                 c = WHITE;
             }
 
-            if (i < 3){
+            if (i < SHOP_ITEM_SLOTS){
                 sprintf(displayText, "%i000$", calculatePrice(i));
                 drawFancyText(displayText, 194 + i * 64, 132, 1, WHITE);
 
             }
-            drawC(37 + i, 194 + i * 64, 100, c);
+            drawC(shopSlotSprites[i], 194 + i * 64, 100, c);
         }
+    }
+}
 
-
-        if (IsKeyPressed(KEY_A)){
+void tickShop(){
+    if (isShopOpen){
+        if (fIsKeyPressed(KEY_A)){
             selectedShopSlot--;
             if (selectedShopSlot < 0){
-                selectedShopSlot = 3;
+                selectedShopSlot = SHOP_SLOTS - 1;
             }
         }
-        if (IsKeyPressed(KEY_D)){
+        if (fIsKeyPressed(KEY_D)){
             selectedShopSlot++;
-            selectedShopSlot %= 4;
+            selectedShopSlot %= SHOP_SLOTS;
         }
 
-        if (IsKeyPressed(KEY_S)){
+        if (fIsKeyPressed(KEY_S)){
             activateSlot();
         }
     }
@@ -222,6 +254,8 @@ void openShop(){
 struct Particle{
     float x;
     float y;
+    float previousX;
+    float previousY;
     float velocityX;
     float velocityY;
     bool exists;
@@ -232,34 +266,334 @@ typedef struct Particle Particle;
 
 
 #define MAX_PARTICLES 30
+#define PARTICLE_DESPAWN_Y 400
 Particle particles[MAX_PARTICLES];
 int nextParticleIndex = 0;
-void updateParticles(){
+void tickParticles(){
     for (int i = 0; i < MAX_PARTICLES; i++){
         Particle* p = &particles[i];
 
         if (p->exists){
+            p->previousX = p->x;
+            p->previousY = p->y;
             p->x += p->velocityX;
             p->y += p->velocityY;
             p->velocityY += (p->velocityY < 3.0f) * 0.1f;
             p->internalTimer++;
 
+            if (p->y - getScroll() > PARTICLE_DESPAWN_Y){
+                p->exists = false;
+            }
+        }
+    }
+}
+
+void drawParticles(float alpha){
+    for (int i = 0; i < MAX_PARTICLES; i++){
+        Particle* p = &particles[i];
 
-            drawC(29 + (((p->internalTimer % 10) / 10.0f) * 3), p->x, p->y - worldOffset - (depth * 32), p->color);
+        if (p->exists){
+            float x = lerp(p->previousX, p->x, alpha);
+            float y = lerp(p->previousY, p->y, alpha);
+            drawC(29 + (((p->internalTimer % 10) / 10.0f) * 3), x, y - drawScroll, p->color);
         }
     }
 }
 
+// particles draw from their own generator so effects never shift the world's random sequence
+unsigned int effectRandomState = 0x2545f491;
+int effectRandom(int min, int max){
+    effectRandomState ^= effectRandomState << 13;
+    effectRandomState ^= effectRandomState >> 17;
+    effectRandomState ^= effectRandomState << 5;
+    return min + effectRandomState % (max - min + 1);
+}
+
 void addParticle(int x, int y, Color c){
     Particle p = {
-        x + GetRandomValue(-16, 16), y + GetRandomValue(-16, 16), GetRandomValue(-1,1), GetRandomValue(-3, 1), true, GetRandomValue(0, 20), c
+        .x = x + effectRandom(-16, 16), .y = y + effectRandom(-16, 16), .velocityX = effectRandom(-1,1), .velocityY = effectRandom(-3, 1),
+        .exists = true, .internalTimer = effectRandom(0, 20), .color = c
     };
+    p.previousX = p.x;
+    p.previousY = p.y;
 
     particles[nextParticleIndex] = p;
     nextParticleIndex++;
     nextParticleIndex %= MAX_PARTICLES;
 }
 
+//------------------------------------------------------------------------------------
+// Events
+//------------------------------------------------------------------------------------
+// simulation only queues effects, drainEvents plays them once per frame with duplicates
+// merged, so a blast or a fast drill costs one sound and one popup a frame
+#define EVENT_MERGED -1
+#define EVENT_SOUND 0
+#define EVENT_POPUP 1
+#define EVENT_PARTICLES 2
+#define EVENT_SHAKE 3
+#define MAX_EVENTS 256
+
+#define POPUP_MONEY 0
+#define POPUP_FUEL 1
+#define POPUP_HEALTH 2
+const char* popupFormats[] = {"%+i000$", "%+iL", "%+iHP"};
+
+struct GameEvent{
+    int type;
+    int x;
+    int y;
+    // popup kind
+    int kind;
+    // popup amount or particle count, summed when events merge
+    int value;
+    float shake;
+    const Sound* sound;
+    Color color;
+};
+typedef struct GameEvent GameEvent;
+
+GameEvent events[MAX_EVENTS];
+int eventCount = 0;
+int droppedEvents = 0;
+
+void queueEvent(GameEvent e){
+    if (eventCount >= MAX_EVENTS){
+        droppedEvents++;
+        return;
+    }
+    events[eventCount++] = e;
+}
+
+void queueSound(const Sound* sound){
+    queueEvent((GameEvent){.type = EVENT_SOUND, .sound = sound});
+}
+
+// y in screen space like initPopup
+void queuePopup(int x, int y, int kind, int value, Color c){
+    queueEvent((GameEvent){.type = EVENT_POPUP, .x = x, .y = y, .kind = kind, .value = value, .color = c});
+}
+
+void queueParticles(int x, int y, int count, Color c){
+    queueEvent((GameEvent){.type = EVENT_PARTICLES, .x = x, .y = y, .value = count, .color = c});
+}
+
+void queueShake(float ammount){
+    queueEvent((GameEvent){.type = EVENT_SHAKE, .shake = ammount});
+}
+
+bool isSameColor(Color a, Color b){
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+bool canMergeEvents(const GameEvent* a, const GameEvent* b){
+    if (a->type != b->type){
+        return false;
+    }
+    switch (a->type){
+        case EVENT_SOUND: return a->sound == b->sound;
+        case EVENT_POPUP: return a->kind == b->kind && isSameColor(a->color, b->color);
+        case EVENT_PARTICLES: return a->x == b->x && a->y == b->y && isSameColor(a->color, b->color);
+        case EVENT_SHAKE: return true;
+    }
+    return false;
+}
+
+void playEvent(const GameEvent* e){
+    char text[TEXT_POPUP_LENGTH];
+    switch (e->type){
+        case EVENT_SOUND: fPlaySound(*e->sound); break;
+        case EVENT_POPUP:
+            if (e->value != 0){
+                snprintf(text, TEXT_POPUP_LENGTH, popupFormats[e->kind], e->value);
+                initPopup(e->x, e->y, text, e->color);
+            }
+            break;
+        case EVENT_PARTICLES:
+            // the ring would overwrite anything past MAX_PARTICLES in one go anyway
+            for (int i = 0; i < min(e->value, MAX_PARTICLES); i++){
+                addParticle(e->x, e->y, e->color);
+            }
+            break;
+        case EVENT_SHAKE: screenShake(e->shake); break;
+    }
+}
+
+// once per frame, the first event of a kind absorbs the ones after it
+void drainEvents(){
+    if (!fEffectsEnabled){
+        eventCount = 0;
+        return;
+    }
+
+    for (int i = 0; i < eventCount; i++){
+        GameEvent* e = &events[i];
+        if (e->type == EVENT_MERGED){
+            continue;
+        }
+        for (int j = i + 1; j < eventCount; j++){
+            if (canMergeEvents(e, &events[j])){
+                e->value += events[j].value;
+                e->shake += events[j].shake;
+                events[j].type = EVENT_MERGED;
+            }
+        }
+        playEvent(e);
+    }
+    eventCount = 0;
+}
+
+//------------------------------------------------------------------------------------
+// Tile definitions
+//------------------------------------------------------------------------------------
+#define MAX_MODIFIERS 16
+#define SPRITE_BANDS 5
+#define TILE_DEFINITIONS_PATH "resources/tiles.txt"
+// telemetry counts mined tiles per modifier
+_Static_assert(MAX_MODIFIERS <= TELEMETRY_ORE_TYPES, "raise TELEMETRY_ORE_TYPES in telemetry.h");
+
+struct OreDefinition{
+    bool defined;
+    int overlaySprite;
+    int miningTime;
+    Color particleColor;
+    Color popupColor;
+    int popupKind;
+    int popupValue;
+    int money;
+    int fuel;
+    int health;
+    bool isOre;
+};
+typedef struct OreDefinition OreDefinition;
+
+struct BandDefinition{
+    bool defined;
+    int miningTime;
+    Color particleColor;
+};
+typedef struct BandDefinition BandDefinition;
+
+// indexed by tile modifier and tile sprite
+OreDefinition oreDefinitions[MAX_MODIFIERS];
+BandDefinition bandDefinitions[SPRITE_BANDS];
+// bit per modifier that pays out money
+unsigned int valuableModifiers = 0;
+
+Color makeColor(int r, int g, int b){
+    Color out = {r, g, b, 255};
+    return out;
+}
+
+bool parseTileDefinition(const char* line, int spriteCount){
+    char kind[8];
+    int id;
+    int r, g, b;
+    int miningBonus;
+
+    if (sscanf(line, "%7s %i", kind, &id) != 2){
+        return false;
+    }
+
+    if (strcmp(kind, "band") == 0){
+        if (id < 0 || id >= SPRITE_BANDS || sscanf(line, "%*s %*i %i %i %i %i", &miningBonus, &r, &g, &b) != 4){
+            return false;
+        }
+        BandDefinition* band = &bandDefinitions[id];
+        band->defined = true;
+        band->miningTime = miningBonus;
+        band->particleColor = makeColor(r, g, b);
+        return true;
+    }
+
+    if (strcmp(kind, "ore") == 0){
+        int overlay, popupR, popupG, popupB, isOre;
+        OreDefinition ore = {0};
+        if (id <= MODIFIER_NONE || id >= MAX_MODIFIERS ||
+            sscanf(line, "%*s %*i %i %i %i %i %i %i %i %i %i %i %i %i", &overlay, &miningBonus, &r, &g, &b,
+                   &popupR, &popupG, &popupB, &ore.money, &ore.fuel, &ore.health, &isOre) != 12){
+            return false;
+        }
+        if (overlay < 0 || overlay >= spriteCount){
+            return false;
+        }
+
+        ore.defined = true;
+        ore.overlaySprite = overlay;
+        ore.miningTime = miningBonus;
+        ore.particleColor = makeColor(r, g, b);
+        ore.popupColor = makeColor(popupR, popupG, popupB);
+        ore.isOre = isOre;
+
+        if (ore.money != 0){
+            ore.popupKind = POPUP_MONEY;
+            ore.popupValue = ore.money;
+        }else if (ore.fuel != 0){
+            ore.popupKind = POPUP_FUEL;
+            ore.popupValue = ore.fuel;
+        }else if (ore.health != 0){
+            ore.popupKind = POPUP_HEALTH;
+            ore.popupValue = ore.health;
+        }
+        char text[TEXT_POPUP_LENGTH * 2];
+        if (snprintf(text, sizeof(text), popupFormats[ore.popupKind], ore.popupValue) >= TEXT_POPUP_LENGTH){
+            return false;
+        }
+
+        oreDefinitions[id] = ore;
+        if (ore.money > 0){
+            valuableModifiers |= 1u << id;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool loadTileDefinitions(const char* path, int spriteCount){
+    FILE* file = fopen(path, "r");
+    if (file == NULL){
+        TraceLog(LOG_ERROR, "TILES: Failed to open %s", path);
+        return false;
+    }
+
+    memset(oreDefinitions, 0, sizeof(oreDefinitions));
+    memset(bandDefinitions, 0, sizeof(bandDefinitions));
+    valuableModifiers = 0;
+
+    char line[256];
+    int lineNumber = 0;
+    bool valid = true;
+    while (fgets(line, sizeof(line), file) != NULL){
+        lineNumber++;
+        char* start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0'){
+            continue;
+        }
+        if (!parseTileDefinition(start, spriteCount)){
+            TraceLog(LOG_ERROR, "TILES: %s:%i: invalid definition", path, lineNumber);
+            valid = false;
+        }
+    }
+    fclose(file);
+
+    // everything the generator can produce has to be defined
+    for (int i = 0; i < SPRITE_BANDS; i++){
+        if (!bandDefinitions[i].defined){
+            TraceLog(LOG_ERROR, "TILES: %s: band %i is not defined", path, i);
+            valid = false;
+        }
+    }
+    for (int i = MODIFIER_NONE + 1; i <= MODIFIER_SPIKES; i++){
+        if (!oreDefinitions[i].defined){
+            TraceLog(LOG_ERROR, "TILES: %s: modifier %i is not defined", path, i);
+            valid = false;
+        }
+    }
+
+    return valid;
+}
+
 //------------------------------------------------------------------------------------
 // World
 //------------------------------------------------------------------------------------
@@ -268,6 +602,11 @@ struct WorldTile{
     bool isSolid;
     int modifier;
     int sprite;
+    bool isQueued;
+    // left open by generation (shop rooms, caves), holds up the tile above like rock does
+    bool isCarved;
+    unsigned char light;
+    bool isExplored;
 };
 typedef struct WorldTile WorldTile;
 
@@ -279,13 +618,198 @@ int convertMiningY(int yToConvert){
 
 WorldTile world[WORLD_WIDTH][WORLD_HEIGHT];
 
+// ore index, kept in sync with world: per row a column bitmask for every modifier
+// and a bitmask of the modifiers present in that row
+unsigned int oreColumns[WORLD_HEIGHT][MAX_MODIFIERS];
+unsigned int rowModifiers[WORLD_HEIGHT];
+
+void indexOreRow(int row){
+    memset(oreColumns[row], 0, sizeof(oreColumns[row]));
+    rowModifiers[row] = 0;
+    for (int x = 0; x < WORLD_WIDTH; x++){
+        int modifier = world[x][row].modifier;
+        oreColumns[row][modifier] |= 1u << x;
+        rowModifiers[row] |= 1u << modifier;
+    }
+    rowModifiers[row] &= ~(1u << MODIFIER_NONE);
+}
+
+void shiftOreIndex(){
+    memmove(oreColumns[0], oreColumns[1], sizeof(oreColumns[0]) * (WORLD_HEIGHT - 1));
+    memmove(&rowModifiers[0], &rowModifiers[1], sizeof(rowModifiers[0]) * (WORLD_HEIGHT - 1));
+}
+
+void indexOre(int x, int row){
+    int modifier = world[x][row].modifier;
+    oreColumns[row][modifier] |= 1u << x;
+    if (modifier != MODIFIER_NONE){
+        rowModifiers[row] |= 1u << modifier;
+    }
+}
+
+void unindexOre(int x, int row){
+    int modifier = world[x][row].modifier;
+    oreColumns[row][modifier] &= ~(1u << x);
+    if (oreColumns[row][modifier] == 0){
+        rowModifiers[row] &= ~(1u << modifier);
+    }
+}
+
+struct OreScan{
+    bool found;
+    int x;
+    int row;
+    int modifier;
+};
+typedef struct OreScan OreScan;
+
+// nearest valuable ore below the given tile, looking at most maxRows rows down
+OreScan scanForOre(int x, int row, int maxRows){
+    OreScan out = {.found = false};
+    int lastRow = min(WORLD_HEIGHT - 1, row + maxRows);
+
+    for (int r = fmax(row + 1, 0); r <= lastRow; r++){
+        unsigned int present = rowModifiers[r] & valuableModifiers;
+        if (present == 0){
+            continue;
+        }
+
+        int bestDistance = WORLD_WIDTH;
+        while (present != 0){
+            int modifier = __builtin_ctz(present);
+            present &= present - 1;
+
+            unsigned int columns = oreColumns[r][modifier];
+            while (columns != 0){
+                int column = __builtin_ctz(columns);
+                columns &= columns - 1;
+
+                if (abs(column - x) < bestDistance){
+                    bestDistance = abs(column - x);
+                    out.found = true;
+                    out.x = column;
+                    out.row = r;
+                    out.modifier = modifier;
+                }
+            }
+        }
+        return out;
+    }
+    return out;
+}
+
+void enqueueFall(int x, int row);
+
+// ambient light kept per tile, recomputed only for rows scrolling in and tiles being cleared,
+// open tiles carry it further down tunnels and pockets
+#define LIGHT_MAX 255
+#define LIGHT_MIN 36
+#define LIGHT_SURFACE_ROW 5
+#define LIGHT_FALLOFF_ROWS 120
+#define LIGHT_SPREAD_STEP 28
+
+int getDepthLight(int absoluteRow){
+    int rowsUnderground = absoluteRow - LIGHT_SURFACE_ROW;
+    if (rowsUnderground <= 0){
+        return LIGHT_MAX;
+    }
+    return fmax(LIGHT_MIN, LIGHT_MAX - rowsUnderground * (LIGHT_MAX - LIGHT_MIN) / LIGHT_FALLOFF_ROWS);
+}
+
+bool passesLight(int x, int row){
+    return x >= 0 && x < WORLD_WIDTH && row >= 0 && row < WORLD_HEIGHT && !world[x][row].isSolid;
+}
+
+void lightRow(int row){
+    for (int x = 0; x < WORLD_WIDTH; x++){
+        int ambient = getDepthLight(row + depth);
+        int fromAbove = passesLight(x, row - 1) ? world[x][row - 1].light - LIGHT_SPREAD_STEP : 0;
+        world[x][row].light = fmax(ambient, fromAbove);
+        world[x][row].isExplored = ambient == LIGHT_MAX;
+    }
+    // sideways through open tiles of the row, one pass each direction
+    for (int x = 1; x < WORLD_WIDTH; x++){
+        if (passesLight(x - 1, row)){
+            world[x][row].light = fmax(world[x][row].light, world[x - 1][row].light - LIGHT_SPREAD_STEP);
+        }
+    }
+    for (int x = WORLD_WIDTH - 2; x >= 0; x--){
+        if (passesLight(x + 1, row)){
+            world[x][row].light = fmax(world[x][row].light, world[x + 1][row].light - LIGHT_SPREAD_STEP);
+        }
+    }
+}
+
+// light only ever grows from a freshly opened tile, so every push is a brighter tile
+// and the flood stops LIGHT_MAX / LIGHT_SPREAD_STEP tiles out at most
+#define LIGHT_QUEUE_SIZE (WORLD_WIDTH * WORLD_HEIGHT * 4)
+int lightQueue[LIGHT_QUEUE_SIZE];
+const int lightOffsets[4][2] = {{0, -1}, {0, 1}, {-1, 0}, {1, 0}};
+
+void spreadLight(int x, int row){
+    int head = 0;
+    int tail = 0;
+
+    for (int i = 0; i < 4; i++){
+        int nx = x + lightOffsets[i][0];
+        int ny = row + lightOffsets[i][1];
+        if (passesLight(nx, ny)){
+            world[x][row].light = fmax(world[x][row].light, world[nx][ny].light - LIGHT_SPREAD_STEP);
+        }
+    }
+    lightQueue[tail++] = row * WORLD_WIDTH + x;
+
+    while (head < tail){
+        int cx = lightQueue[head] % WORLD_WIDTH;
+        int cy = lightQueue[head] / WORLD_WIDTH;
+        head++;
+        // solid tiles are lit but block it
+        if (world[cx][cy].isSolid){
+            continue;
+        }
+
+        int passed = world[cx][cy].light - LIGHT_SPREAD_STEP;
+        for (int i = 0; i < 4; i++){
+            int nx = cx + lightOffsets[i][0];
+            int ny = cy + lightOffsets[i][1];
+            if (nx < 0 || nx >= WORLD_WIDTH || ny < 0 || ny >= WORLD_HEIGHT || world[nx][ny].light >= passed){
+                continue;
+            }
+            world[nx][ny].light = passed;
+            if (tail < LIGHT_QUEUE_SIZE){
+                lightQueue[tail++] = ny * WORLD_WIDTH + nx;
+            }
+        }
+    }
+}
+
+// mined out tile, keeps the ore index in sync and wakes up the tiles it was holding
+void clearTile(int x, int row){
+    unindexOre(x, row);
+    world[x][row].isSolid = false;
+    world[x][row].modifier = MODIFIER_NONE;
+    spreadLight(x, row);
+
+    enqueueFall(x, row - 1);
+    enqueueFall(x - 1, row);
+    enqueueFall(x + 1, row);
+}
+
 void finishedMiningTile(int x, int y);
 
-void updateWorld(){
+#define FALL_INTERVAL 8
+void updateFallingRocks();
+
+#define CREATURE_SPAWN_CHANCE 4
+void spawnCreature(float x, float y);
+
+Color getTileTint(int x, int row);
+
+void drawWorld(){
     if (depth < 20){
         // draw grass
         for (int i = 0; i < WORLD_WIDTH; i++){
-            draw(41, i * 32, 160 - worldOffset - (depth * 32));
+            draw(41, i * 32, 160 - drawScroll);
         }
 
     }
@@ -293,41 +817,43 @@ void updateWorld(){
     for (int x = 0; x < WORLD_WIDTH; x++){
         for (int y = 0; y < WORLD_HEIGHT; y++){
             WorldTile tile = world[x][y];
+            int tileY = (y + depth) * 32 - drawScroll;
+            Color tint = getTileTint(x, y);
 
             if (tile.type == TYPE_ROCK){
-                draw((tile.sprite * 2) + !tile.isSolid, x * 32, y * 32 - worldOffset);
-
-                if (tile.modifier != MODIFIER_NONE){
-                    int modifierValue = tile.modifier + MODIFIER_OFFSET;
-                    switch (tile.modifier){
-                        case MODIFIER_SPIKES: modifierValue = 15; break;
-                        case MODIFIER_ZIRCON: modifierValue = 33; break;
-                        case MODIFIER_COBALT: modifierValue = 34; break;
-                        case MODIFIER_OPAL: modifierValue = 35; break;
-                    }
-                    draw(modifierValue, x * 32, y * 32 - worldOffset);
+                drawC((tile.sprite * 2) + !tile.isSolid, x * 32, tileY, tint);
+
+                if (tile.modifier != MODIFIER_NONE && tile.isExplored){
+                    drawC(oreDefinitions[tile.modifier].overlaySprite, x * 32, tileY, tint);
                 }
 
             }else if (tile.type == TYPE_TOUGH_ROCK){
-                draw(10, x * 32, y * 32 - worldOffset);
+                drawC(10, x * 32, tileY, tint);
             }
 
         }
     }
 
+    // mining, a tile finished by this tick's input is cleared next tick and has no crack frame left
+    if (!(miningX == 0 && miningY == -1) && miningProgress < currentMiningTime){
+        draw(16 + floor(((float)miningProgress / currentMiningTime * 3)), miningX * 32, miningY * 32 - drawScroll);
+    }
+}
+
+void tickWorld(){
     // mining
     int y = convertMiningY(miningY);
     if (miningProgress >= currentMiningTime && !(miningX == 0 && miningY == -1)){
         finishedMiningTile(miningX, miningY);
-        WorldTile* tile = &world[miningX][y];
-        tile->isSolid = false;
-        tile->modifier = MODIFIER_NONE;
-        screenShake(4.5f);
+        clearTile(miningX, y);
+        queueShake(4.5f);
         miningProgress = 0;
         miningX = 0;
         miningY = -1;
-    }else {
-        draw(16 + floor(((float)miningProgress / currentMiningTime * 3)), miningX * 32, y * 32 - worldOffset);
+    }
+
+    if (gameTimer % FALL_INTERVAL == 0){
+        updateFallingRocks();
     }
 }
 
@@ -336,21 +862,7 @@ int getMiningTimeForTile(int x, int y){
 
     WorldTile tile = world[x][cY];
 
-    int out = miningTime;
-
-    out += tile.sprite * 30;
-    if (tile.sprite > 2){
-        out += tile.sprite * 10;
-    }
-    switch (tile.modifier){
-        case MODIFIER_COAL:out += 10;break;
-        case MODIFIER_SILVER:out += 30;break;
-        case MODIFIER_GOLD:out += 60;break;
-        case MODIFIER_DIAMONDS:out += 100;break;
-        case MODIFIER_ZIRCON:out += 120;break;
-        case MODIFIER_COBALT:out += 130; break;
-        case MODIFIER_OPAL:out += 200; break;
-    }
+    int out = miningTime + bandDefinitions[tile.sprite].miningTime + oreDefinitions[tile.modifier].miningTime;
 
     if (out < 5){
         return 5;
@@ -372,48 +884,26 @@ Color getColorForTile(int x, int y){
     int cY = convertMiningY(y);
 
     WorldTile tile = world[x][cY];
-    Color out = WHITE;
-
-    switch (tile.sprite){
-        default:
-        case 0: out.r = 38; out.g = 133; out.b = 76; break;
-        case 1: out.r = 162; out.g = 109; out.b = 63; break;
-        case 2: out.r = 222; out.g = 93; out.b = 58; break;
-        case 3: out.r = 107; out.g = 58; out.b = 222; break;
-        case 4: out.r = 107; out.g = 38; out.b = 67; break;
-    }
-
+    Color out = bandDefinitions[tile.sprite].particleColor;
 
     if (tile.modifier != MODIFIER_NONE && GetRandomValue(0, 9) > 6){
-        switch (tile.modifier){
-            default:
-            case MODIFIER_SILVER: out.r = 222; out.g = 206; out.b = 237; break;
-            case MODIFIER_GOLD: out.r = 243; out.g = 168; out.b = 51; break;
-            case MODIFIER_DIAMONDS: out.r = 109; out.g = 234; out.b = 214; break;
-            case MODIFIER_SPIKES: out.r = 236; out.g = 39; out.b = 63; break;
-            case MODIFIER_COAL: out.r = 44; out.g = 30; out.b = 49; break;
-            case MODIFIER_ZIRCON: out.r = 90; out.g = 181; out.b = 82; break;
-            case MODIFIER_COBALT: out.r = 51; out.g = 136; out.b = 222; break;
-            case MODIFIER_OPAL: out.r = 255; out.g = 162; out.b = 172; break;
-
-        }
-
+        out = oreDefinitions[tile.modifier].particleColor;
     }
 
     return out;
 }
 
-Sound getSoundForTile(int x, int y){
+const Sound* getSoundForTile(int x, int y){
 
     int cY = convertMiningY(y);
 
     WorldTile tile = world[x][cY];
 
-    if (tile.modifier != MODIFIER_NONE && tile.modifier != MODIFIER_SPIKES && GetRandomValue(0, 9) > 4){
-        return oreMineSound;
+    if (oreDefinitions[tile.modifier].isOre && GetRandomValue(0, 9) > 4){
+        return &oreMineSound;
 
     }else {
-        return mineSound;
+        return &mineSound;
 
     }
 }
@@ -449,8 +939,8 @@ void mineTile(int x, int y){
 
         if (gameTimer % 3 == 0){
             Color c = getColorForTile(x, y);
-            addParticle(x * 32, y * 32, c);
-            PlaySound(getSoundForTile(x, y));
+            queueParticles(x * 32, y * 32, 1, c);
+            queueSound(getSoundForTile(x, y));
         }
     }else {
         miningX = x;
@@ -460,74 +950,172 @@ void mineTile(int x, int y){
     }
 }
 
-WorldTile generateTile(int tileDepth){
-    WorldTile output;
+// caves, ore veins and spike clusters come from gradient noise sampled at (column, depth),
+// frequencies are per tile
+#define CAVE_DEPTH 30
+#define CAVE_FREQUENCY 0.11f
+#define CAVE_THRESHOLD 0.42f
+#define VEIN_FREQUENCY 0.08f
+// veins are the thin band where the noise crosses zero
+#define VEIN_WIDTH 0.07f
+#define VEIN_MODIFIER_CHANCE 50
+// slow so a vein keeps its ore along its length
+#define ORE_KIND_FREQUENCY 0.04f
+#define SPIKE_FREQUENCY 0.22f
+#define NOISE_CAVE 0x9e3779b9u
+#define NOISE_VEIN 0x85ebca6bu
+#define NOISE_ORE_KIND 0xc2b2ae35u
+#define NOISE_SPIKES 0x27d4eb2fu
+
+unsigned int worldSeed = 0;
+
+struct RowNoise{
+    float cave[WORLD_WIDTH];
+    float vein[WORLD_WIDTH];
+    float oreKind[WORLD_WIDTH];
+    float spikes[WORLD_WIDTH];
+};
+typedef struct RowNoise RowNoise;
 
-    output.isSolid = true;
-    output.modifier = 0;
-    output.sprite = 0;
-    output.type = TYPE_ROCK;
-    output.modifier = MODIFIER_NONE;
+void sampleRowNoise(RowNoise* out, int tileDepth){
+    fNoiseRow(out->cave, WORLD_WIDTH, 0.0f, CAVE_FREQUENCY, tileDepth * CAVE_FREQUENCY, worldSeed ^ NOISE_CAVE);
+    fNoiseRow(out->vein, WORLD_WIDTH, 0.0f, VEIN_FREQUENCY, tileDepth * VEIN_FREQUENCY, worldSeed ^ NOISE_VEIN);
+    fNoiseRow(out->oreKind, WORLD_WIDTH, 0.0f, ORE_KIND_FREQUENCY, tileDepth * ORE_KIND_FREQUENCY, worldSeed ^ NOISE_ORE_KIND);
+    fNoiseRow(out->spikes, WORLD_WIDTH, 0.0f, SPIKE_FREQUENCY, tileDepth * SPIKE_FREQUENCY, worldSeed ^ NOISE_SPIKES);
+}
 
-    // choose sprite
+struct GenerationProfile{
+    int depth;
+    int minSprite;
+    int maxSprite;
+    bool isAir;
+    bool isShopRow;
+    bool hasModifiers;
+    int toughRockChance;
+    int modifierChance;
+    int spikeChance;
+    int goldChance;
+    bool canHaveDiamonds;
+    bool canHaveZircon;
+    int modifierBonus;
+    bool hasCaves;
+    float spikeThreshold;
+};
+typedef struct GenerationProfile GenerationProfile;
 
+// everything generateTile needs that depends only on depth, evaluated once per row
+GenerationProfile getGenerationProfile(int tileDepth){
+    GenerationProfile out = {0};
+    out.depth = tileDepth;
+
+    // choose sprite band
     if (tileDepth < 150){
-        output.sprite = 0;
+        out.minSprite = 0; out.maxSprite = 0;
     }else if (tileDepth < 160){
-        output.sprite = GetRandomValue(0, 1);
+        out.minSprite = 0; out.maxSprite = 1;
     }else if (tileDepth < 270){
-        output.sprite = 1;
+        out.minSprite = 1; out.maxSprite = 1;
     }else if (tileDepth < 280){
-        output.sprite = GetRandomValue(1, 2);
+        out.minSprite = 1; out.maxSprite = 2;
     }else if (tileDepth < 400){
-        output.sprite = 2;
+        out.minSprite = 2; out.maxSprite = 2;
     }else if (tileDepth < 410){
-        output.sprite = GetRandomValue(2,3);
+        out.minSprite = 2; out.maxSprite = 3;
     }else if (tileDepth < 600){
-        output.sprite = 3;
+        out.minSprite = 3; out.maxSprite = 3;
     }else if (tileDepth < 610){
-        output.sprite = GetRandomValue(3, 4);
+        out.minSprite = 3; out.maxSprite = 4;
     }else {
-        output.sprite = 4;
+        out.minSprite = 4; out.maxSprite = 4;
+    }
+
+    out.isAir = tileDepth <= 5;
+    out.isShopRow = tileDepth % 120 >= 115;
+    out.hasModifiers = tileDepth > 10;
+    out.toughRockChance = min(10, (tileDepth / 20));
+    out.modifierChance = min(45, fmax((tileDepth / 20.0f), 5));
+
+    float wave = sin(tileDepth * DEG2RAD) * 0.5f + 0.5f;
+    out.spikeChance = min(45, (float)tileDepth / 20 + (wave * 20.0f));
+    out.goldChance = min(45, (float)tileDepth / 10 + (wave * 30.0f));
+    out.canHaveDiamonds = tileDepth > 150;
+    out.canHaveZircon = tileDepth > 350;
+    out.modifierBonus = (tileDepth > 250) + (tileDepth > 650);
+    out.hasCaves = tileDepth > CAVE_DEPTH;
+    // spike clusters grow with spikeChance
+    out.spikeThreshold = 0.75f - out.spikeChance * 0.008f;
+
+    return out;
+}
+
+int getVeinModifier(const GenerationProfile* profile, float oreKind){
+    // stretched to 0-1, the noise rarely gets near its extremes
+    float kind = fmin(fmax(oreKind * 0.8f + 0.5f, 0.0f), 1.0f);
+    if (kind < 0.25f){
+        return MODIFIER_COAL;
+    }
+    int modifier = MODIFIER_SILVER + profile->modifierBonus;
+    modifier += kind * 100 > 100 - profile->goldChance;
+    modifier += kind > 0.7f && profile->canHaveDiamonds;
+    modifier += kind > 0.85f && profile->canHaveZircon;
+    return modifier;
+}
+
+WorldTile generateTile(const GenerationProfile* profile, const RowNoise* noise, int x){
+    WorldTile output;
+
+    output.isSolid = true;
+    output.type = TYPE_ROCK;
+    output.modifier = MODIFIER_NONE;
+    output.isQueued = false;
+    output.isCarved = false;
+    output.light = 0;
+    output.isExplored = false;
+
+    // choose sprite
+    output.sprite = profile->minSprite;
+    if (profile->maxSprite != profile->minSprite){
+        output.sprite = GetRandomValue(profile->minSprite, profile->maxSprite);
     }
 
+    // shop rows are hollowed out
+    if (profile->isShopRow){
+        output.isSolid = false;
+        output.isCarved = true;
+        return output;
+    }
 
     // generate air
-    if (tileDepth <= 5){
+    if (profile->isAir){
         output.isSolid = false;
+        output.isCarved = true;
         output.type = TYPE_AIR;
-    }else if (GetRandomValue(0, 100) < min(10, (tileDepth / 20))){
+    }else if (profile->hasCaves && noise->cave[x] > CAVE_THRESHOLD){
+        output.isSolid = false;
+        output.isCarved = true;
+    }else if (GetRandomValue(0, 100) < profile->toughRockChance){
         output.type = TYPE_TOUGH_ROCK;
-    }else if (tileDepth > 10){
-        // generate modifier
+    }else if (profile->hasModifiers && fabs(noise->vein[x]) < VEIN_WIDTH){
+        if (GetRandomValue(0, 100) < VEIN_MODIFIER_CHANCE){
+            output.modifier = getVeinModifier(profile, noise->oreKind[x]);
+        }
+    }else if (profile->hasModifiers && noise->spikes[x] > profile->spikeThreshold){
+        output.modifier = MODIFIER_SPIKES;
+    }else if (profile->hasModifiers){
+        // scattered modifiers between the veins
         int rng = GetRandomValue(0, 100);
 
-        if (rng < min(45, fmax((tileDepth / 20.0f), 5))){
+        if (rng < profile->modifierChance / 2){
             rng = GetRandomValue(0, 100);
 
-            if (rng < min(45, (float)tileDepth / 20 + ((sin(tileDepth * DEG2RAD) * 0.5f + 0.5f) * 20.0f))){
+            if (rng < profile->spikeChance){
                 output.modifier = MODIFIER_SPIKES;
             }else if (rng < 90){
                 // money
-                output.modifier = MODIFIER_SILVER;
-                rng = GetRandomValue(0, 100);
-                if (rng < min(45, (float)tileDepth / 10 + ((sin(tileDepth * DEG2RAD) * 0.5f + 0.5f) * 30.0f))){
-                    output.modifier++;
-                }
-                rng = GetRandomValue(0, 20);
-                if (rng > 10 && tileDepth > 150){
-                    output.modifier++;
-                }
-                if (tileDepth > 250){
-                    output.modifier++;
-                }
-                rng = GetRandomValue(0, 10);
-                if (tileDepth > 350 && rng > 6){
-                    output.modifier++;
-                }
-                if (tileDepth > 650){
-                    output.modifier++;
-                }
+                output.modifier = MODIFIER_SILVER + profile->modifierBonus;
+                output.modifier += GetRandomValue(0, 100) < profile->goldChance;
+                output.modifier += GetRandomValue(0, 20) > 10 && profile->canHaveDiamonds;
+                output.modifier += GetRandomValue(0, 10) > 6 && profile->canHaveZircon;
             }else {
                 // coal
                 output.modifier = MODIFIER_COAL;
@@ -540,17 +1128,21 @@ WorldTile generateTile(int tileDepth){
 
 
 void generateLayer(int layer){
-    for (int i = 0; i < WORLD_WIDTH; i++){
-        world[i][layer] = generateTile(depth + layer);
-        // generate shop
-        if ((layer + depth) % 120 >= 115){
-            world[i][layer].isSolid = false;
-            world[i][layer].type = TYPE_ROCK;
-            world[i][layer].modifier = MODIFIER_NONE;
+    GenerationProfile profile = getGenerationProfile(layer + depth);
+    RowNoise noise;
+    sampleRowNoise(&noise, layer + depth);
+    fTelemetry.rowsGenerated++;
 
+    for (int i = 0; i < WORLD_WIDTH; i++){
+        world[i][layer] = generateTile(&profile, &noise, i);
+        if (!world[i][layer].isSolid){
+            if (profile.hasCaves && !profile.isShopRow && GetRandomValue(0, 100) < CREATURE_SPAWN_CHANCE){
+                spawnCreature(i * 32, (layer + depth) * 32);
+            }
         }
-
     }
+    indexOreRow(layer);
+
     if (layer + depth == 5){
         generateShop(layer+depth);
     }
@@ -558,6 +1150,18 @@ void generateLayer(int layer){
     if ((layer+depth) % 120 == 119){
         generateShop(layer+depth);
     }
+    lightRow(layer);
+}
+
+// shift world upwards, the bottom row is left for the caller to fill
+void shiftWorld(){
+    for (int i = 0; i < WORLD_HEIGHT - 1; i++){
+        for (int j = 0; j < WORLD_WIDTH; j++){
+            world[j][i] = world[j][i+1];
+        }
+    }
+    shiftOreIndex();
+    depth++;
 }
 
 void moveDown(float ammount){
@@ -565,13 +1169,7 @@ void moveDown(float ammount){
 
     if (worldOffset > 32.0f){
         worldOffset -= 32.0f;
-        // shift world upwards
-        for (int i = 0; i < WORLD_HEIGHT - 1; i++){
-            for (int j = 0; j < WORLD_WIDTH; j++){
-                world[j][i] = world[j][i+1];
-            }
-        }
-        depth++;
+        shiftWorld();
         generateLayer(WORLD_HEIGHT - 1);
     }
 }
@@ -596,6 +1194,9 @@ struct Player{
     float velocityY;
     int direction;
     int money;
+    int charges;
+    float previousX;
+    float previousY;
 };
 typedef struct Player Player;
 
@@ -611,11 +1212,16 @@ Player initPlayer(float x, float y){
         .velocityY = 0.0f,
         .direction = DIRECTION_RIGHT,
         .money = 100,
+        .charges = 0,
+        .previousX = x,
+        .previousY = y,
     };
     return out;
 }
 Player player;
 
+void detonateCharge(int x, int y);
+
 void playerAlive(bool isOnGround, float convY){
 
     // camera
@@ -624,19 +1230,19 @@ void playerAlive(bool isOnGround, float convY){
     }
 
     // movement
-    if (IsKeyDown(KEY_A) && player.velocityX > -2.5f){
+    if (fIsKeyDown(KEY_A) && player.velocityX > -2.5f){
         player.velocityX -= 0.1f;
         player.direction = DIRECTION_LEFT;
         player.fuel -= 0.01f;
 
 
-    }else if (IsKeyDown(KEY_D) && player.velocityX < 2.5f){
+    }else if (fIsKeyDown(KEY_D) && player.velocityX < 2.5f){
         player.velocityX += 0.1f;
         player.direction = DIRECTION_RIGHT;
         player.fuel -= 0.01f;
 
 
-    }else if (IsKeyDown(KEY_S)){
+    }else if (fIsKeyDown(KEY_S)){
         player.direction = DIRECTION_DOWN;
 
         if (isOnGround){
@@ -645,16 +1251,21 @@ void playerAlive(bool isOnGround, float convY){
         }
     }
 
-    if (player.velocityX != 0 && !IsKeyDown(KEY_A) && !IsKeyDown(KEY_D)) {
+    if (player.velocityX != 0 && !fIsKeyDown(KEY_A) && !fIsKeyDown(KEY_D)) {
         player.velocityX *= 0.9;
         if (fabs(player.velocityX) < 0.1f){
                 player.velocityX = 0;
         }
     }
 
-    if (IsKeyPressed(KEY_W) && isOnGround){
+    if (fIsKeyPressed(KEY_W) && isOnGround){
         player.velocityY -= 2.5f;
-        PlaySound(jumpSound);
+        queueSound(&jumpSound);
+    }
+
+    if (fIsKeyPressed(KEY_E) && player.charges > 0){
+        player.charges--;
+        detonateCharge((player.x + 16) / 32, (player.y + 16) / 32);
     }
 
     // shop
@@ -665,9 +1276,11 @@ void playerAlive(bool isOnGround, float convY){
     }
 }
 
-void updatePlayer(){
+void tickPlayer(){
     bool isOnGround = true;
     float convY = player.y - worldOffset - (depth * 32);
+    player.previousX = player.x;
+    player.previousY = player.y;
 
 
     if (canMoveToWH(player.x + 2, player.y + 34, 28, 1)){
@@ -705,95 +1318,553 @@ void updatePlayer(){
     if (player.fuel < 0){
         player.fuel = 0;
     }
+}
+
+void drawPlayer(float alpha){
+    bool isAlive = player.health > 0 && player.fuel > 0;
+    float x = lerp(player.previousX, player.x, alpha);
+    float convY = lerp(player.previousY, player.y, alpha) - drawScroll;
 
-    // draw
     int yOffset = 1;
     if (player.direction == DIRECTION_DOWN && isAlive){
         yOffset = 7;
     }
     if (isAlive){
-        draw(23 + (player.direction * 2) + ((gameTimer % 10) > 5), player.x, convY + yOffset);
+        draw(23 + (player.direction * 2) + ((gameTimer % 10) > 5), x, convY + yOffset);
     }else {
-        draw(32, player.x, convY + yOffset);
+        draw(32, x, convY + yOffset);
 
     }
+}
 
+//------------------------------------------------------------------------------------
+// Lighting
+//------------------------------------------------------------------------------------
+// the lantern is added on top of the stored ambient light when tiles are tinted,
+// fog hides tiles until the lantern has reached them once
+#define LANTERN_BASE_RADIUS 3
+#define LANTERN_RADIUS_PER_LEVEL 1
+#define FOG_LIGHT 12
+
+int exploredColumn = -1;
+int exploredRow = -1;
+int exploredDepth = -1;
+int exploredRadius = -1;
+
+int getLanternRadius(){
+    return LANTERN_BASE_RADIUS + itemLevels[SHOP_SLOT_LANTERN] * LANTERN_RADIUS_PER_LEVEL;
+}
 
+// only walks the lantern circle when the player enters another tile, the world scrolls or the lantern grows
+void exploreAroundPlayer(){
+    int column = (player.x + 16) / 32;
+    int row = (player.y + 16) / 32;
+    int radius = getLanternRadius();
+    if (column == exploredColumn && row == exploredRow && depth == exploredDepth && radius == exploredRadius){
+        return;
+    }
+    exploredColumn = column;
+    exploredRow = row;
+    exploredDepth = depth;
+    exploredRadius = radius;
+
+    for (int y = -radius; y <= radius; y++){
+        int resident = convertMiningY(row + y);
+        if (resident < 0 || resident >= WORLD_HEIGHT){
+            continue;
+        }
+        for (int x = -radius; x <= radius; x++){
+            if (column + x >= 0 && column + x < WORLD_WIDTH && x * x + y * y <= radius * radius){
+                world[column + x][resident].isExplored = true;
+            }
+        }
+    }
 }
 
-void finishedMiningTile(int x, int y){
-    PlaySound(breakSound);
-    int cY = convertMiningY(y);
-    char str[TEXT_POPUP_LENGTH];
+Color getTileTint(int x, int row){
+    const WorldTile* tile = &world[x][row];
+    if (!tile->isExplored){
+        return (Color){FOG_LIGHT, FOG_LIGHT, FOG_LIGHT, 255};
+    }
+
+    int light = tile->light;
+    float radius = getLanternRadius() * 32.0f;
+    float dx = x * 32 - player.x;
+    float dy = (row + depth) * 32 - player.y;
+    if (fabs(dx) < radius && fabs(dy) < radius){
+        float distance = sqrtf(dx * dx + dy * dy);
+        light = fmax(light, LIGHT_MAX * (1.0f - distance / radius));
+    }
+    return (Color){light, light, light, 255};
+}
+
+struct TileReward{
+    int money;
+    int fuel;
+    int health;
+};
+typedef struct TileReward TileReward;
+
+void addTileReward(TileReward* reward, const OreDefinition* ore){
+    reward->money += ore->money;
+    reward->fuel += ore->fuel;
+    reward->health += ore->health;
+}
+
+void applyTileReward(TileReward reward){
+    player.money += reward.money;
+    player.health += reward.health;
+    player.fuel += reward.fuel;
+    if (player.fuel > player.maxFuel){
+        player.fuel = player.maxFuel;
+    }
+}
+
+void finishedMiningTile(int x, int y){
+    queueSound(&breakSound);
+    int cY = convertMiningY(y);
 
     WorldTile tile = world[x][cY];
-    switch(tile.modifier){
-        case MODIFIER_COAL:
-            strcpy(str, "+10L");
-            initPopup(x * 32, cY * 32, str, WHITE);
+    const OreDefinition* ore = &oreDefinitions[tile.modifier];
+    fTelemetry.tilesMined[tile.modifier]++;
 
-            player.fuel += 10;
-            if (player.fuel > player.maxFuel){
-                player.fuel = player.maxFuel;
-            }
-            break;
-        case MODIFIER_SILVER:
-            strcpy(str, "+2000$");
-            initPopup(x * 32, cY * 32, str, GOLD);
-            player.money += 2;
-            break;
-        case MODIFIER_GOLD:
-            strcpy(str, "+15000$");
-            initPopup(x * 32, cY * 32, str, GOLD);
-            player.money += 15;
-            break;
-        case MODIFIER_DIAMONDS:
-            strcpy(str, "+36000$");
-            initPopup(x * 32, cY * 32, str, BLUE);
-            player.money += 36;
-            break;
-        case MODIFIER_SPIKES:
-            strcpy(str, "-15HP");
-            initPopup(x * 32, cY * 32, str, RED);
-            player.health -= 15;
-            break;
-        case MODIFIER_ZIRCON:
-            strcpy(str, "+98000$");
-            initPopup(x * 32, cY * 32, str, GREEN);
-            player.money += 98;
-            break;
-        case MODIFIER_COBALT:
-            strcpy(str, "+256000$");
-            initPopup(x * 32, cY * 32, str, BLUE);
-            player.money += 256;
-            break;
-        case MODIFIER_OPAL:
-            strcpy(str, "+734000$");
-            initPopup(x * 32, cY * 32, str, PINK);
-            player.money += 734;
-            break;
+    if (ore->popupValue != 0){
+        queuePopup(x * 32, cY * 32, ore->popupKind, ore->popupValue, ore->popupColor);
     }
+
+    TileReward reward = {0};
+    addTileReward(&reward, ore);
+    applyTileReward(reward);
 }
 
 void activateSlot(){
 
-    if (selectedShopSlot <= 2){
+    if (selectedShopSlot < SHOP_ITEM_SLOTS){
         if (player.money < calculatePrice(selectedShopSlot)){
             return;
         }
         player.money -= calculatePrice(selectedShopSlot);
         itemLevels[selectedShopSlot]++;
-        PlaySound(buySound);
+        queueSound(&buySound);
     }
 
 
     switch (selectedShopSlot){
 
-        case 0: miningTime -= 15;break;
-        case 1: player.maxFuel += 10; break;
-        case 2: player.maxHealth += 10; break;
-        case 3: isShopOpen = false; player.health = player.maxHealth; player.fuel = player.maxFuel; break;
+        case SHOP_SLOT_DRILL: miningTime -= 15;break;
+        case SHOP_SLOT_FUEL: player.maxFuel += 10; break;
+        case SHOP_SLOT_HULL: player.maxHealth += 10; break;
+        case SHOP_SLOT_SCANNER: break;
+        case SHOP_SLOT_CHARGES: player.charges++; break;
+        case SHOP_SLOT_LANTERN: break;
+        case SHOP_SLOT_EXIT: isShopOpen = false; player.health = player.maxHealth; player.fuel = player.maxFuel; break;
+
+    }
+}
+
+//------------------------------------------------------------------------------------
+// Falling rocks
+//------------------------------------------------------------------------------------
+#define FALLING_ROCK_DAMAGE 10
+#define MAX_FALL_CELLS (WORLD_WIDTH * WORLD_HEIGHT * 2)
+
+// cells that might have lost their support, rows are stored with depth added
+// so the lists stay valid while the world scrolls
+struct FallCell{
+    int x;
+    int y;
+};
+typedef struct FallCell FallCell;
+
+FallCell fallCells[2][MAX_FALL_CELLS];
+int fallCellCount[2] = {0, 0};
+int nextFallList = 0;
+
+void enqueueFall(int x, int row){
+    if (x < 0 || x >= WORLD_WIDTH || row < 0 || row >= WORLD_HEIGHT){
+        return;
+    }
+    WorldTile* tile = &world[x][row];
+    if (tile->isQueued || !tile->isSolid || fallCellCount[nextFallList] >= MAX_FALL_CELLS){
+        return;
+    }
+
+    tile->isQueued = true;
+    FallCell cell = {x, row + depth};
+    fallCells[nextFallList][fallCellCount[nextFallList]++] = cell;
+}
+
+bool isTileSolidAt(int x, int row){
+    if (x < 0 || x >= WORLD_WIDTH){
+        return true;
+    }
+    return world[x][row].isSolid;
+}
+
+// loose ore falls as soon as it is undermined, plain rock only when it isn't wedged between neighbours,
+// only mined out cells undermine, generated hollows never start a collapse
+bool isTileUnsupported(int x, int row){
+    WorldTile tile = world[x][row];
+    if (!tile.isSolid || tile.type != TYPE_ROCK || row >= WORLD_HEIGHT - 1 || world[x][row + 1].isSolid || world[x][row + 1].isCarved){
+        return false;
+    }
+    return tile.modifier != MODIFIER_NONE || !(isTileSolidAt(x - 1, row) && isTileSolidAt(x + 1, row));
+}
+
+void dropTile(int x, int row){
+    WorldTile tile = world[x][row];
+    tile.isQueued = false;
+    // light and fog belong to the place, not the rock
+    tile.light = world[x][row + 1].light;
+    tile.isExplored = world[x][row + 1].isExplored;
+
+    if (miningX == x && convertMiningY(miningY) == row){
+        miningX = 0;
+        miningY = -1;
+        miningProgress = 0;
+    }
+
+    clearTile(x, row);
+
+    if (checkBoxCollisions(player.x, player.y, 32, 32, x * 32, (row + 1 + depth) * 32, 32, 32)){
+        // shatters on the player
+        player.health -= FALLING_ROCK_DAMAGE;
+        queuePopup(x * 32, (row + 1) * 32, POPUP_HEALTH, -FALLING_ROCK_DAMAGE, RED);
+        queueShake(6.0f);
+        queueSound(&breakSound);
+        queueParticles(x * 32, (row + 1 + depth) * 32, 3, bandDefinitions[tile.sprite].particleColor);
+        return;
+    }
+
+    world[x][row + 1] = tile;
+    indexOre(x, row + 1);
+    enqueueFall(x, row + 1);
+}
+
+// settles one step of every cell queued since the last call
+void updateFallingRocks(){
+    int list = nextFallList;
+    nextFallList = !nextFallList;
+    fallCellCount[nextFallList] = 0;
+
+    for (int i = 0; i < fallCellCount[list]; i++){
+        FallCell cell = fallCells[list][i];
+        int row = convertMiningY(cell.y);
+        if (row < 0){
+            continue;
+        }
+        world[cell.x][row].isQueued = false;
+
+        if (isTileUnsupported(cell.x, row)){
+            dropTile(cell.x, row);
+        }
+    }
+    fallCellCount[list] = 0;
+}
+
+//------------------------------------------------------------------------------------
+// Explosives
+//------------------------------------------------------------------------------------
+#define BLAST_RADIUS 2
+#define SPIKE_BLAST_RADIUS 1
+#define MAX_BLAST_CELLS (WORLD_WIDTH * WORLD_HEIGHT * 4)
+#define MAX_BLAST_PARTICLES 8
+
+struct BlastCell{
+    int x;
+    int row;
+    int reach;
+};
+typedef struct BlastCell BlastCell;
+
+// static so a blast never allocates, blastReach is valid where blastStamp matches the current blast
+BlastCell blastCells[MAX_BLAST_CELLS];
+int blastReach[WORLD_WIDTH][WORLD_HEIGHT];
+int blastStamp[WORLD_WIDTH][WORLD_HEIGHT];
+int currentBlast = 0;
+
+int blastCellCount = 0;
+void pushBlastCell(int x, int row, int reach){
+    if (x < 0 || x >= WORLD_WIDTH || row < 0 || row >= WORLD_HEIGHT || blastCellCount >= MAX_BLAST_CELLS){
+        return;
+    }
+    // only revisit a cell if this wave reaches further than the last one did
+    if (blastStamp[x][row] == currentBlast && blastReach[x][row] >= reach){
+        return;
+    }
+    blastStamp[x][row] = currentBlast;
+    blastReach[x][row] = reach;
+
+    BlastCell cell = {x, row, reach};
+    blastCells[blastCellCount++] = cell;
+}
+
+// clears rock around the given tile, spikes in range detonate as well, ore is paid out at once
+void detonateCharge(int x, int y){
+    currentBlast++;
+    blastCellCount = 0;
+
+    int minedTiles = 0;
+    TileReward reward = {0};
+    pushBlastCell(x, convertMiningY(y), BLAST_RADIUS);
+
+    for (int i = 0; i < blastCellCount; i++){
+        BlastCell cell = blastCells[i];
+        WorldTile tile = world[cell.x][cell.row];
+
+        // tough rock stops the blast
+        if (tile.type == TYPE_TOUGH_ROCK){
+            continue;
+        }
+
+        int reach = cell.reach;
+        if (tile.isSolid && tile.type == TYPE_ROCK){
+            if (tile.modifier == MODIFIER_SPIKES){
+                reach = fmax(reach, SPIKE_BLAST_RADIUS);
+            }
+
+            const OreDefinition* ore = &oreDefinitions[tile.modifier];
+            if (ore->isOre){
+                addTileReward(&reward, ore);
+            }
+            fTelemetry.tilesMined[tile.modifier]++;
+
+            if (minedTiles % 2 == 0 && minedTiles / 2 < MAX_BLAST_PARTICLES){
+                queueParticles(cell.x * 32, (cell.row + depth) * 32, 1, bandDefinitions[tile.sprite].particleColor);
+            }
+            if (miningX == cell.x && convertMiningY(miningY) == cell.row){
+                miningX = 0;
+                miningY = -1;
+                miningProgress = 0;
+            }
+
+            clearTile(cell.x, cell.row);
+            minedTiles++;
+        }
+
+        if (reach > 0){
+            pushBlastCell(cell.x - 1, cell.row, reach - 1);
+            pushBlastCell(cell.x + 1, cell.row, reach - 1);
+            pushBlastCell(cell.x, cell.row - 1, reach - 1);
+            pushBlastCell(cell.x, cell.row + 1, reach - 1);
+        }
+    }
+
+    // one round of effects for the whole blast
+    queueSound(&breakSound);
+    queueShake(4.5f + minedTiles);
+
+    if (reward.money > 0){
+        queuePopup(x * 32, convertMiningY(y) * 32, POPUP_MONEY, reward.money, GOLD);
+    }else if (reward.fuel > 0){
+        queuePopup(x * 32, convertMiningY(y) * 32, POPUP_FUEL, reward.fuel, WHITE);
+    }
+    applyTileReward(reward);
+}
+
+//------------------------------------------------------------------------------------
+// Creatures
+//------------------------------------------------------------------------------------
+#define MAX_CREATURES 512
+#define CREATURE_SPEED 0.6f
+#define CREATURE_DAMAGE 5
+#define CREATURE_HURT_COOLDOWN 45
+// hitbox inside the 32x32 sprite
+#define CREATURE_OFFSET_X 2
+#define CREATURE_OFFSET_Y 8
+#define CREATURE_WIDTH 28
+#define CREATURE_HEIGHT 22
+
+struct Creature{
+    float x;
+    float y;
+    float previousX;
+    float previousY;
+    float velocityY;
+    int direction;
+    int internalTimer;
+};
+typedef struct Creature Creature;
+
+// kept dense, removal swaps the last creature in
+Creature creatures[MAX_CREATURES];
+int creatureCount = 0;
+int playerHurtTimer = 0;
+// dormant creatures stand still, only walking ones keep the game from resting
+bool haveCreaturesMoved = false;
+
+// creatures bucketed by the tile their center is in, rebuilt every tick
+#define CREATURE_CELLS (WORLD_WIDTH * WORLD_HEIGHT)
+int creatureCellStart[CREATURE_CELLS + 1];
+int creatureCellItems[MAX_CREATURES];
+
+void spawnCreature(float x, float y){
+    if (creatureCount >= MAX_CREATURES){
+        return;
+    }
+    Creature c = {
+        .x = x, .y = y, .previousX = x, .previousY = y, .velocityY = 0.0f,
+        .direction = GetRandomValue(0, 1) * 2 - 1, .internalTimer = GetRandomValue(0, 40)
+    };
+    creatures[creatureCount++] = c;
+}
+
+// -1 outside the resident world, tickCreatures removes those before the cells are built
+int getCreatureCell(const Creature* c){
+    int column = (c->x + 16) / 32;
+    int row = convertMiningY((c->y + 16) / 32);
+    if (column < 0 || column >= WORLD_WIDTH || row < 0 || row >= WORLD_HEIGHT){
+        return -1;
+    }
+    return row * WORLD_WIDTH + column;
+}
+
+// moveCreature probes up to a tile below the creature, the bottom row has nothing generated under it yet
+bool isCreatureAwake(const Creature* c){
+    return convertMiningY((c->y + 40) / 32) < WORLD_HEIGHT;
+}
+
+bool creaturesOverlap(const Creature* a, const Creature* b){
+    return checkBoxCollisions(a->x + CREATURE_OFFSET_X, a->y + CREATURE_OFFSET_Y, CREATURE_WIDTH, CREATURE_HEIGHT,
+                              b->x + CREATURE_OFFSET_X, b->y + CREATURE_OFFSET_Y, CREATURE_WIDTH, CREATURE_HEIGHT);
+}
+
+void moveCreature(Creature* c){
+    c->previousX = c->x;
+    c->previousY = c->y;
+    c->internalTimer++;
+
+    float left = c->x + CREATURE_OFFSET_X;
+    float top = c->y + CREATURE_OFFSET_Y;
+
+    // gravity
+    if (canMoveToWH(left, top + CREATURE_HEIGHT + c->velocityY + 1, CREATURE_WIDTH, 1)){
+        c->velocityY = fmin(c->velocityY + 0.1f, 3.0f);
+        c->y += c->velocityY;
+    }else {
+        c->velocityY = 0;
+    }
+
+    // walk until a wall or a ledge
+    float nextX = left + c->direction * CREATURE_SPEED;
+    float probeX = c->direction > 0 ? nextX + CREATURE_WIDTH : nextX;
+    bool isBlocked = !canMoveToWH(probeX, top, 1, CREATURE_HEIGHT);
+    bool isLedge = c->velocityY == 0 && canMoveToWH(probeX, top + CREATURE_HEIGHT + 1, 1, 1);
+    if (isBlocked || isLedge){
+        c->direction = -c->direction;
+    }else {
+        c->x += c->direction * CREATURE_SPEED;
+    }
+}
+
+void buildCreatureCells(){
+    memset(creatureCellStart, 0, sizeof(creatureCellStart));
+    for (int i = 0; i < creatureCount; i++){
+        creatureCellStart[getCreatureCell(&creatures[i]) + 1]++;
+    }
+    for (int i = 0; i < CREATURE_CELLS; i++){
+        creatureCellStart[i + 1] += creatureCellStart[i];
+    }
+
+    int cellFill[CREATURE_CELLS];
+    memcpy(cellFill, creatureCellStart, sizeof(cellFill));
+    for (int i = 0; i < creatureCount; i++){
+        creatureCellItems[cellFill[getCreatureCell(&creatures[i])]++] = i;
+    }
+}
+
+// creatures in the 3x3 tiles around a pixel position, a box up to a tile big can only touch those
+int queryCreatureCells(float x, float y, int* out, int maxOut){
+    int count = 0;
+    int column = x / 32;
+    int row = convertMiningY(y / 32);
+
+    for (int r = fmax(row - 1, 0); r <= min(row + 1, WORLD_HEIGHT - 1); r++){
+        for (int c = fmax(column - 1, 0); c <= min(column + 1, WORLD_WIDTH - 1); c++){
+            int cell = r * WORLD_WIDTH + c;
+            for (int i = creatureCellStart[cell]; i < creatureCellStart[cell + 1] && count < maxOut; i++){
+                out[count++] = creatureCellItems[i];
+            }
+        }
+    }
+    return count;
+}
+
+void hurtPlayerByCreature(const Creature* c){
+    player.health -= CREATURE_DAMAGE;
+    playerHurtTimer = CREATURE_HURT_COOLDOWN;
+    queuePopup(player.x, convertMiningY(player.y / 32) * 32, POPUP_HEALTH, -CREATURE_DAMAGE, RED);
+    queueShake(3.0f);
+    queueParticles(c->x, c->y, 1, RED);
+}
+
+void tickCreatures(){
+    haveCreaturesMoved = false;
+    for (int i = 0; i < creatureCount;){
+        Creature* c = &creatures[i];
+        // scrolled out of the resident world, moving would probe rows above it
+        if (c->y < depth * 32){
+            *c = creatures[--creatureCount];
+            continue;
+        }
+        if (isCreatureAwake(c)){
+            moveCreature(c);
+        }else {
+            c->previousX = c->x;
+            c->previousY = c->y;
+        }
+        // the spatial hash only covers the resident world
+        if (getCreatureCell(c) < 0){
+            *c = creatures[--creatureCount];
+            continue;
+        }
+        haveCreaturesMoved |= c->x != c->previousX || c->y != c->previousY;
+        i++;
+    }
+
+    buildCreatureCells();
+
+    // creatures turn around when they walk into each other
+    int nearby[MAX_CREATURES];
+    for (int i = 0; i < creatureCount; i++){
+        Creature* c = &creatures[i];
+        int count = queryCreatureCells(c->x + 16, c->y + 16, nearby, MAX_CREATURES);
+        for (int j = 0; j < count; j++){
+            Creature* other = &creatures[nearby[j]];
+            if (other != c && (other->x - c->x) * c->direction > 0 && creaturesOverlap(c, other)){
+                c->direction = -c->direction;
+                break;
+            }
+        }
+    }
 
+    if (playerHurtTimer > 0){
+        playerHurtTimer--;
+        return;
+    }
+    if (player.health <= 0){
+        return;
+    }
+    int count = queryCreatureCells(player.x + 16, player.y + 16, nearby, MAX_CREATURES);
+    for (int i = 0; i < count; i++){
+        Creature* c = &creatures[nearby[i]];
+        if (checkBoxCollisions(player.x, player.y, 32, 32, c->x + CREATURE_OFFSET_X, c->y + CREATURE_OFFSET_Y, CREATURE_WIDTH, CREATURE_HEIGHT)){
+            hurtPlayerByCreature(c);
+            break;
+        }
+    }
+}
+
+void drawCreatures(float alpha){
+    for (int i = 0; i < creatureCount; i++){
+        Creature* c = &creatures[i];
+        float x = lerp(c->previousX, c->x, alpha);
+        float y = lerp(c->previousY, c->y, alpha) - drawScroll;
+        int cell = getCreatureCell(c);
+        if (cell < 0){
+            continue;
+        }
+        drawC(19 + (c->internalTimer / 8) % 4, x, y, getTileTint(cell % WORLD_WIDTH, cell / WORLD_WIDTH));
     }
 }
 
@@ -801,9 +1872,11 @@ void activateSlot(){
 // hud
 //------------------------------------------------------------------------------------
 #define DEPTH_COUNTER_SIZE 30
+#define SCANNER_BASE_RANGE 2
+#define SCANNER_RANGE_PER_LEVEL 4
 char display[DEPTH_COUNTER_SIZE];
 
-void updateHud(){
+void drawHud(){
     // depth
     drawFancyText("Hloubka", 10, 10, 20, YELLOW);
     sprintf(display, "%06i", depth);
@@ -824,9 +1897,379 @@ void updateHud(){
     sprintf(display, "%06i000$", player.money);
     drawFancyText(display, 510, 10, 20, YELLOW);
 
+    // charges
+    if (player.charges > 0){
+        drawFancyText("Naloze", 410, 70, 20, ORANGE);
+        sprintf(display, "%i", player.charges);
+        drawFancyText(display, 510, 70, 20, ORANGE);
+    }
+
+    // scanner
+    if (itemLevels[SHOP_SLOT_SCANNER] > 0){
+        drawFancyText("Sken", 410, 40, 20, SKYBLUE);
+        int playerRow = convertMiningY((player.y + 16) / 32);
+        int playerColumn = (player.x + 16) / 32;
+        OreScan scan = scanForOre(playerColumn, playerRow, SCANNER_BASE_RANGE + itemLevels[SHOP_SLOT_SCANNER] * SCANNER_RANGE_PER_LEVEL);
+        if (scan.found){
+            draw(oreDefinitions[scan.modifier].overlaySprite, 500, 34);
+            sprintf(display, "%im", (int)pythagoras(playerColumn, playerRow, scan.x, scan.row));
+            drawFancyText(display, 540, 40, 20, SKYBLUE);
+        }else {
+            drawFancyText("---", 540, 40, 20, SKYBLUE);
+        }
+    }
+
+}
+
+
+
+//------------------------------------------------------------------------------------
+// Spectators
+//------------------------------------------------------------------------------------
+// with --serve every tick sends what changed since the last tick, values quantized to ints and
+// tiles packed, both diffed against the state sent last. A spectator that just joined gets
+// a keyframe, the same encoding diffed against nothing
+#define NET_RECORD_KEYFRAME 0
+#define NET_RECORD_VALUES 1
+#define NET_RECORD_ROW 2
+#define NET_RECORD_TILE 3
+#define NET_RECORD_POPUP 4
+// a row with more changed tiles than this is sent whole
+#define NET_ROW_THRESHOLD 6
+#define NET_UNKNOWN_TILE 0xffff
+// positions travel in quarter pixels and fuel in tenths
+#define NET_POSITION_SCALE 4.0f
+#define NET_FUEL_SCALE 10.0f
+
+#define NET_VALUE_DEPTH 0
+#define NET_VALUE_OFFSET 1
+#define NET_VALUE_PLAYER_X 2
+#define NET_VALUE_PLAYER_Y 3
+#define NET_VALUE_DIRECTION 4
+#define NET_VALUE_HEALTH 5
+#define NET_VALUE_MAX_HEALTH 6
+#define NET_VALUE_FUEL 7
+#define NET_VALUE_MAX_FUEL 8
+#define NET_VALUE_MONEY 9
+#define NET_VALUE_CHARGES 10
+#define NET_VALUE_MINING_X 11
+#define NET_VALUE_MINING_Y 12
+#define NET_VALUE_MINING_PROGRESS 13
+#define NET_VALUE_MINING_TIME 14
+#define NET_VALUE_SHOP_X 15
+#define NET_VALUE_SHOP_Y 16
+#define NET_VALUE_SHOP_FLAGS 17
+#define NET_VALUE_SHOP_SLOT 18
+#define NET_VALUE_ITEM_LEVELS 19
+#define NET_VALUE_COUNT (NET_VALUE_ITEM_LEVELS + SHOP_ITEM_SLOTS)
+_Static_assert(NET_VALUE_COUNT <= 32, "changed values are sent as a 32 bit mask");
+
+struct SpectatorState{
+    int values[NET_VALUE_COUNT];
+    unsigned short tiles[WORLD_WIDTH][WORLD_HEIGHT];
+    int popupsCreated;
+};
+typedef struct SpectatorState SpectatorState;
+
+// server side
+SpectatorState sentState;
+SpectatorState currentState;
+SpectatorState emptyState;
+NetBuffer deltaMessage;
+NetBuffer keyframeMessage;
+// spectator side
+SpectatorState receivedState;
+NetBuffer receivedMessage;
+
+unsigned short packTile(const WorldTile* tile){
+    return tile->type | (tile->isSolid << 2) | (tile->sprite << 3) | (tile->modifier << 6);
+}
+
+void captureSpectatorState(SpectatorState* out){
+    int* v = out->values;
+    v[NET_VALUE_DEPTH] = depth;
+    v[NET_VALUE_OFFSET] = roundf(worldOffset * NET_POSITION_SCALE);
+    v[NET_VALUE_PLAYER_X] = roundf(player.x * NET_POSITION_SCALE);
+    v[NET_VALUE_PLAYER_Y] = roundf(player.y * NET_POSITION_SCALE);
+    v[NET_VALUE_DIRECTION] = player.direction;
+    v[NET_VALUE_HEALTH] = player.health;
+    v[NET_VALUE_MAX_HEALTH] = player.maxHealth;
+    v[NET_VALUE_FUEL] = roundf(player.fuel * NET_FUEL_SCALE);
+    v[NET_VALUE_MAX_FUEL] = roundf(player.maxFuel * NET_FUEL_SCALE);
+    v[NET_VALUE_MONEY] = player.money;
+    v[NET_VALUE_CHARGES] = player.charges;
+    v[NET_VALUE_MINING_X] = miningX;
+    v[NET_VALUE_MINING_Y] = miningY;
+    v[NET_VALUE_MINING_PROGRESS] = miningProgress;
+    v[NET_VALUE_MINING_TIME] = currentMiningTime;
+    v[NET_VALUE_SHOP_X] = shopX;
+    v[NET_VALUE_SHOP_Y] = shopY;
+    v[NET_VALUE_SHOP_FLAGS] = isShopOpen | (shopInteracted << 1);
+    v[NET_VALUE_SHOP_SLOT] = selectedShopSlot;
+    for (int i = 0; i < SHOP_ITEM_SLOTS; i++){
+        v[NET_VALUE_ITEM_LEVELS + i] = itemLevels[i];
+    }
+
+    for (int x = 0; x < WORLD_WIDTH; x++){
+        for (int y = 0; y < WORLD_HEIGHT; y++){
+            out->tiles[x][y] = packTile(&world[x][y]);
+        }
+    }
+    out->popupsCreated = popupsCreated;
+}
+
+// rows that scrolled in are unknown to spectators
+void shiftSentTiles(SpectatorState* state, int rows){
+    for (int x = 0; x < WORLD_WIDTH; x++){
+        for (int y = 0; y < WORLD_HEIGHT; y++){
+            state->tiles[x][y] = y + rows < WORLD_HEIGHT ? state->tiles[x][y + rows] : NET_UNKNOWN_TILE;
+        }
+    }
+}
+
+void encodeSpectatorState(NetBuffer* out, const SpectatorState* from, const SpectatorState* to, bool isKeyframe){
+    out->length = 0;
+    out->isBroken = false;
+    if (isKeyframe){
+        netWriteByte(out, NET_RECORD_KEYFRAME);
+    }
+
+    // values first, the spectator has to scroll before rows arrive
+    unsigned int changed = 0;
+    for (int i = 0; i < NET_VALUE_COUNT; i++){
+        changed |= (unsigned int)(to->values[i] != from->values[i]) << i;
+    }
+    if (changed != 0){
+        netWriteByte(out, NET_RECORD_VALUES);
+        netWriteVarint(out, changed);
+        for (int i = 0; i < NET_VALUE_COUNT; i++){
+            if (changed & (1u << i)){
+                netWriteSigned(out, to->values[i] - from->values[i]);
+            }
+        }
+    }
+
+    for (int y = 0; y < WORLD_HEIGHT; y++){
+        int changedTiles = 0;
+        for (int x = 0; x < WORLD_WIDTH; x++){
+            changedTiles += to->tiles[x][y] != from->tiles[x][y];
+        }
+
+        if (changedTiles > NET_ROW_THRESHOLD){
+            netWriteByte(out, NET_RECORD_ROW);
+            netWriteVarint(out, y);
+            for (int x = 0; x < WORLD_WIDTH; x++){
+                netWriteVarint(out, to->tiles[x][y]);
+            }
+        }else if (changedTiles > 0){
+            for (int x = 0; x < WORLD_WIDTH; x++){
+                if (to->tiles[x][y] != from->tiles[x][y]){
+                    netWriteByte(out, NET_RECORD_TILE);
+                    netWriteVarint(out, x);
+                    netWriteVarint(out, y);
+                    netWriteVarint(out, to->tiles[x][y]);
+                }
+            }
+        }
+    }
+
+    int newPopups = min(to->popupsCreated - from->popupsCreated, MAX_POPUPS);
+    for (int i = newPopups; i > 0; i--){
+        const TextPopup* p = &popups[(nextPopupIndex - i + MAX_POPUPS) % MAX_POPUPS];
+        int length = strlen(p->text);
+        netWriteByte(out, NET_RECORD_POPUP);
+        netWriteSigned(out, p->x);
+        netWriteSigned(out, p->y);
+        netWriteByte(out, p->c.r);
+        netWriteByte(out, p->c.g);
+        netWriteByte(out, p->c.b);
+        netWriteByte(out, p->c.a);
+        netWriteVarint(out, length);
+        for (int j = 0; j < length; j++){
+            netWriteByte(out, p->text[j]);
+        }
+    }
+}
+
+// runs at the end of every tick
+void serveSpectators(){
+    if (!fNetIsServing()){
+        return;
+    }
+    fNetAcceptClients();
+    captureSpectatorState(&currentState);
+
+    int scrolled = currentState.values[NET_VALUE_DEPTH] - sentState.values[NET_VALUE_DEPTH];
+    if (scrolled < 0 || scrolled >= WORLD_HEIGHT){
+        fNetRequestKeyframes();
+        scrolled = WORLD_HEIGHT;
+    }
+    shiftSentTiles(&sentState, scrolled);
+    encodeSpectatorState(&deltaMessage, &sentState, &currentState, false);
+    if (deltaMessage.isBroken){
+        fNetRequestKeyframes();
+        deltaMessage.length = 0;
+    }
+
+    bool needsKeyframe = fNetNeedsKeyframe();
+    if (needsKeyframe){
+        memset(&emptyState, 0, sizeof(emptyState));
+        memset(emptyState.tiles, 0xff, sizeof(emptyState.tiles));
+        emptyState.popupsCreated = currentState.popupsCreated;
+        encodeSpectatorState(&keyframeMessage, &emptyState, &currentState, true);
+    }
+    fNetBroadcast(&deltaMessage, needsKeyframe ? &keyframeMessage : NULL);
+    sentState = currentState;
+}
+
+void applyReceivedValues(bool isKeyframe){
+    const int* v = receivedState.values;
+    if (isKeyframe){
+        depth = v[NET_VALUE_DEPTH];
+    }
+    while (depth < v[NET_VALUE_DEPTH]){
+        shiftWorld();
+    }
+
+    worldOffset = v[NET_VALUE_OFFSET] / NET_POSITION_SCALE;
+    player.x = v[NET_VALUE_PLAYER_X] / NET_POSITION_SCALE;
+    player.y = v[NET_VALUE_PLAYER_Y] / NET_POSITION_SCALE;
+    player.direction = v[NET_VALUE_DIRECTION];
+    player.health = v[NET_VALUE_HEALTH];
+    player.maxHealth = v[NET_VALUE_MAX_HEALTH];
+    player.fuel = v[NET_VALUE_FUEL] / NET_FUEL_SCALE;
+    player.maxFuel = v[NET_VALUE_MAX_FUEL] / NET_FUEL_SCALE;
+    player.money = v[NET_VALUE_MONEY];
+    player.charges = v[NET_VALUE_CHARGES];
+    miningX = v[NET_VALUE_MINING_X];
+    miningY = v[NET_VALUE_MINING_Y];
+    miningProgress = v[NET_VALUE_MINING_PROGRESS];
+    currentMiningTime = v[NET_VALUE_MINING_TIME];
+    shopX = v[NET_VALUE_SHOP_X];
+    shopY = v[NET_VALUE_SHOP_Y];
+    isShopOpen = v[NET_VALUE_SHOP_FLAGS] & 1;
+    shopInteracted = (v[NET_VALUE_SHOP_FLAGS] >> 1) & 1;
+    selectedShopSlot = v[NET_VALUE_SHOP_SLOT];
+    for (int i = 0; i < SHOP_ITEM_SLOTS; i++){
+        itemLevels[i] = v[NET_VALUE_ITEM_LEVELS + i];
+    }
+
+    if (isKeyframe){
+        player.previousX = player.x;
+        player.previousY = player.y;
+        previousScroll = getScroll();
+    }
 }
 
+void unpackTile(WorldTile* tile, unsigned int code){
+    tile->type = code & 3;
+    tile->isSolid = (code >> 2) & 1;
+    tile->sprite = min((code >> 3) & 7, SPRITE_BANDS - 1);
+    tile->modifier = min(code >> 6, MAX_MODIFIERS - 1);
+}
 
+void applyReceivedTile(int x, int row, unsigned int code){
+    bool wasSolid = world[x][row].isSolid;
+    unindexOre(x, row);
+    unpackTile(&world[x][row], code);
+    indexOre(x, row);
+    if (wasSolid && !world[x][row].isSolid){
+        spreadLight(x, row);
+    }
+}
+
+// true if the message carried any record, the server never sends empty deltas
+bool applySpectatorMessage(NetBuffer* message){
+    bool hasChanged = false;
+    bool isKeyframe = false;
+    // rows from here down scrolled in with this message and are lit from scratch
+    int freshRow = WORLD_HEIGHT;
+
+    while (message->position < message->length && !message->isBroken){
+        int record = netReadByte(message);
+        hasChanged = true;
+
+        if (record == NET_RECORD_KEYFRAME){
+            isKeyframe = true;
+            freshRow = 0;
+            memset(&receivedState, 0, sizeof(receivedState));
+        }else if (record == NET_RECORD_VALUES){
+            unsigned int changed = netReadVarint(message);
+            int previousDepth = depth;
+            for (int i = 0; i < NET_VALUE_COUNT; i++){
+                if (changed & (1u << i)){
+                    receivedState.values[i] += netReadSigned(message);
+                }
+            }
+            applyReceivedValues(isKeyframe);
+            if (!isKeyframe){
+                freshRow = fmax(WORLD_HEIGHT - (depth - previousDepth), 0);
+            }
+        }else if (record == NET_RECORD_ROW){
+            int row = netReadVarint(message);
+            if (row < 0 || row >= WORLD_HEIGHT){
+                break;
+            }
+            for (int x = 0; x < WORLD_WIDTH; x++){
+                unsigned int code = netReadVarint(message);
+                if (row >= freshRow){
+                    unpackTile(&world[x][row], code);
+                }else {
+                    applyReceivedTile(x, row, code);
+                }
+            }
+            if (row >= freshRow){
+                indexOreRow(row);
+                lightRow(row);
+            }
+        }else if (record == NET_RECORD_TILE){
+            int x = netReadVarint(message);
+            int row = netReadVarint(message);
+            unsigned int code = netReadVarint(message);
+            if (x < 0 || x >= WORLD_WIDTH || row < 0 || row >= WORLD_HEIGHT){
+                break;
+            }
+            applyReceivedTile(x, row, code);
+        }else if (record == NET_RECORD_POPUP){
+            int x = netReadSigned(message);
+            int y = netReadSigned(message);
+            Color c = {netReadByte(message), netReadByte(message), netReadByte(message), netReadByte(message)};
+            char text[TEXT_POPUP_LENGTH] = {0};
+            int length = netReadVarint(message);
+            for (int i = 0; i < length; i++){
+                char character = netReadByte(message);
+                if (i < TEXT_POPUP_LENGTH - 1){
+                    text[i] = character;
+                }
+            }
+            initPopup(x, y, text, c);
+        }else {
+            TraceLog(LOG_WARNING, "NET: Unknown record %i", record);
+            break;
+        }
+    }
+    return hasChanged;
+}
+
+// mining progress, shop browsing and cleared plain rock only show up in the received state,
+// set by any tick of a frame and cleared by the rest check once per frame
+bool hasReceivedChanges = false;
+
+// a spectator only replays what the server sends, input is ignored
+void tickSpectator(){
+    gameTimer++;
+    previousScroll = getScroll();
+    player.previousX = player.x;
+    player.previousY = player.y;
+
+    UpdateMusicStream(music);
+    tickParticles();
+    tickPopups();
+    while (fNetReceive(&receivedMessage)){
+        hasReceivedChanges |= applySpectatorMessage(&receivedMessage);
+    }
+    exploreAroundPlayer();
+}
 
 //------------------------------------------------------------------------------------
 // reset
@@ -834,11 +2277,16 @@ void updateHud(){
 void reset(){
     depth = 0;
     worldOffset = 0.0f;
+    previousScroll = 0.0f;
+    creatureCount = 0;
+    haveCreaturesMoved = false;
     miningTime = 40;
+    exploredColumn = -1;
 
-    for (int i = 0; i < 3; i++ ){
+    for (int i = 0; i < SHOP_ITEM_SLOTS; i++ ){
         itemLevels[i] = 0;
     }
+    worldSeed = GetRandomValue(0, 1 << 30);
     for (int i = 0; i < WORLD_HEIGHT; i++){
         generateLayer(i);
     }
@@ -847,37 +2295,164 @@ void reset(){
 }
 
 
+//------------------------------------------------------------------------------------
+// benchmark
+//------------------------------------------------------------------------------------
+#ifdef BENCHMARK
+#include <time.h>
+#define BENCHMARK_ROWS 2000000
+#define BENCHMARK_NOISE_ROWS 20000000
+// the player falls at most about 3 px a tick, moveDown never asks for more rows than that
+#define BENCHMARK_MAX_SCROLL_SPEED 3.0f
+
+double benchmarkSeconds(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+// build with -O2 -DBENCHMARK, prints row generation throughput and exits
+void benchmarkGeneration(){
+    SetRandomSeed(1);
+    int generatedModifiers = 0;
+    double start = benchmarkSeconds();
+    for (int row = 0; row < BENCHMARK_ROWS; row++){
+        depth = row % 1000;
+        generateLayer(WORLD_HEIGHT - 1);
+        generatedModifiers += world[row % WORLD_WIDTH][WORLD_HEIGHT - 1].modifier;
+    }
+    double elapsed = benchmarkSeconds() - start;
+
+    printf("generated %i rows in %.3fs, %.0f rows/s (%.1f ns/tile, checksum %i)\n",
+        BENCHMARK_ROWS, elapsed, BENCHMARK_ROWS / elapsed, elapsed * 1000000000.0 / ((double)BENCHMARK_ROWS * WORLD_WIDTH), generatedModifiers);
+    printf("moveDown asks for at most %.1f rows/s\n", BENCHMARK_MAX_SCROLL_SPEED * TICK_RATE / 32.0f);
+    depth = 0;
+}
+
+// one noise channel over a world row, batched against one sample at a time
+void benchmarkNoise(){
+    float samples[WORLD_WIDTH];
+    float checksum = 0.0f;
+    double start = benchmarkSeconds();
+    for (int row = 0; row < BENCHMARK_NOISE_ROWS; row++){
+        fNoiseRow(samples, WORLD_WIDTH, 0.0f, CAVE_FREQUENCY, row * CAVE_FREQUENCY, NOISE_CAVE);
+        checksum += samples[row % WORLD_WIDTH];
+    }
+    double batched = benchmarkSeconds() - start;
+
+    start = benchmarkSeconds();
+    for (int row = 0; row < BENCHMARK_NOISE_ROWS; row++){
+        fNoiseRowScalar(samples, WORLD_WIDTH, 0.0f, CAVE_FREQUENCY, row * CAVE_FREQUENCY, NOISE_CAVE);
+        checksum += samples[row % WORLD_WIDTH];
+    }
+    double scalar = benchmarkSeconds() - start;
+
+    printf("noise row: %.1f ns batched, %.1f ns scalar (%.1fx, checksum %f)\n",
+        batched * 1000000000.0 / BENCHMARK_NOISE_ROWS, scalar * 1000000000.0 / BENCHMARK_NOISE_ROWS, scalar / batched, checksum);
+}
+#endif
+
+
+//------------------------------------------------------------------------------------
+// frame
+//------------------------------------------------------------------------------------
+const Color BACKGROUND_COLOR = {51, 136, 222, 255};
+
+// game side of the counters telemetry.h describes, the framework fills in the rest
+void updateGameTelemetry(){
+    fTelemetry.depth = depth;
+    fTelemetry.particleCount = 0;
+    fTelemetry.popupCount = 0;
+    for (int i = 0; i < MAX_PARTICLES; i++){
+        fTelemetry.particleCount += particles[i].exists;
+    }
+    for (int i = 0; i < MAX_POPUPS; i++){
+        fTelemetry.popupCount += popups[i].exists;
+    }
+}
+
+// both run on the framework's simulation thread, ticks at TICK_RATE and draws once per presented frame
+void tickGame(){
+    gameTimer++;
+    previousScroll = getScroll();
+
+    UpdateMusicStream(music);
+    tickWorld();
+    tickShop();
+    tickPlayer();
+    exploreAroundPlayer();
+    tickCreatures();
+    tickParticles();
+    tickPopups();
+    updateGameTelemetry();
+    serveSpectators();
+}
+
+// nothing left that would change the picture without input, covers the open shop,
+// a dead player and a player standing still
+bool isGameAtRest(){
+    bool hasPlayerMoved = player.previousX != player.x || player.previousY != player.y;
+    bool hasSpectatorChanged = hasReceivedChanges;
+    hasReceivedChanges = false;
+    if (hasPlayerMoved || previousScroll != getScroll() || fallCellCount[nextFallList] > 0 || haveCreaturesMoved || eventCount > 0 || hasSpectatorChanged){
+        return false;
+    }
+
+    for (int i = 0; i < MAX_PARTICLES; i++){
+        if (particles[i].exists){
+            return false;
+        }
+    }
+    for (int i = 0; i < MAX_POPUPS; i++){
+        if (popups[i].exists){
+            return false;
+        }
+    }
+    return true;
+}
+
+// alpha is how far the frame lies between the previous tick and the last one
+void drawGame(float alpha){
+    drainEvents();
+    drawScroll = lerp(previousScroll, getScroll(), alpha);
+
+    fDrawBegin();
+        fClear(BACKGROUND_COLOR);
+        drawWorld();
+        drawShop();
+        drawCreatures(alpha);
+        drawPlayer(alpha);
+        drawParticles(alpha);
+        drawPopups();
+        drawHud();
+    fDrawEnd();
+}
+
 //------------------------------------------------------------------------------------
 // Program main entry point
 //------------------------------------------------------------------------------------
-int main(void)
+int main(int argc, char** argv)
 {
+#ifdef BENCHMARK
+    benchmarkNoise();
+    benchmarkGeneration();
+    return 0;
+#endif
 
+    fParseArguments(argc, argv);
     initFramework();
+    if (!loadTileDefinitions(TILE_DEFINITIONS_PATH, loadedSheet.width * loadedSheet.height)){
+        disposeFramework();
+        return 1;
+    }
     InitAudioDevice();
     loadSounds();
 
-    const Color BACKGROUND_COLOR = {51, 136, 222, 255};
     reset();
     PlayMusicStream(music);
 
     // Main game loop
-    while (!WindowShouldClose())
-    {
-        gameTimer++;
-        
-        fDrawBegin();
-            UpdateMusicStream(music);
-            ClearBackground(BACKGROUND_COLOR);
-            updateWorld();
-            updateShop();
-            updatePlayer();
-            updateParticles();
-            updatePopups();
-            updateHud();
-        fDrawEnd();
-        
-    }
+    fRun(fSpectateAddress != NULL ? tickSpectator : tickGame, drawGame, isGameAtRest);
 
 	disposeFramework();
     unloadSounds();
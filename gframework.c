@@ -2,7 +2,32 @@
 #define G_FRAMEWORK
 
 #include "raylib.h"
+#include "rlgl.h"
+#include "telemetry.h"
+#include <GL/gl.h>
+#include <errno.h>
 #include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 //------------------------------------------------------
 // Conf
 //------------------------------------------------------
@@ -11,6 +36,27 @@ const int SCREEN_HEIGHT = 720;
 const char* WINDOW_NAME = "template window";
 const int DEFAULT_SPRITE_SIZE = 32;
 const float DEFAULT_CAMERA_ZOOM = 2.0f;
+const char* RESOURCE_DIRECTORY = "resources";
+const char* SPRITESHEET_PATH = "resources/spritesheet.png";
+// simulation rate, independent of how often frames are presented
+#define TICK_RATE 60
+#define MAX_TICKS_PER_FRAME 5
+const double TICK_TIME = 1.0 / TICK_RATE;
+// while nothing moves the screen isn't redrawn and input is polled at this interval
+const double IDLE_POLL_TIME = 0.01;
+
+// command line, see fParseArguments
+bool fHeadless = false;
+int fFrameLimit = 0;
+const char* fFrameDirectory = NULL;
+bool fPrintFrameHashes = false;
+bool fHasRandomSeed = false;
+int fRandomSeed = 0;
+const char* fCapturePath = NULL;
+const char* fTelemetryName = NULL;
+int fServePort = 0;
+const char* fSpectateAddress = NULL;
+bool fEffectsEnabled = true;
 
 
 //------------------------------------------------------------------------------------
@@ -51,6 +97,134 @@ float sign(float input){
 	return -1;
 }
 
+double fNow(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+//------------------------------------------------------
+// noise
+//------------------------------------------------------
+// seeded 2d gradient noise, roughly -1 to 1. Lattice corners are hashed instead of looked up
+// so a row of samples needs no gathers, the SSE2 path does 4 samples at a time and matches
+// the scalar one bit for bit
+unsigned int noiseHash(int x, int y, unsigned int seed){
+	unsigned int h = ((unsigned int)x * 0x27d4eb2du) ^ ((unsigned int)y * 0x165667b1u) ^ seed;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	return h;
+}
+
+// one of the four diagonals, picked by the low two bits
+float noiseGradient(unsigned int hash, float x, float y){
+	return ((hash & 1) ? -x : x) + ((hash & 2) ? -y : y);
+}
+
+float noiseFade(float t){
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+float fNoise(float x, float y, unsigned int seed){
+	int ix = floorf(x);
+	int iy = floorf(y);
+	float fx = x - ix;
+	float fy = y - iy;
+
+	float g00 = noiseGradient(noiseHash(ix, iy, seed), fx, fy);
+	float g10 = noiseGradient(noiseHash(ix + 1, iy, seed), fx - 1.0f, fy);
+	float g01 = noiseGradient(noiseHash(ix, iy + 1, seed), fx, fy - 1.0f);
+	float g11 = noiseGradient(noiseHash(ix + 1, iy + 1, seed), fx - 1.0f, fy - 1.0f);
+
+	float u = noiseFade(fx);
+	float v = noiseFade(fy);
+	float top = g00 + (g10 - g00) * u;
+	float bottom = g01 + (g11 - g01) * u;
+	return top + (bottom - top) * v;
+}
+
+#ifdef __SSE2__
+// SSE2 has no 32 bit multiply that keeps the low half, build it from two 64 bit ones
+__m128i noiseMultiply(__m128i a, __m128i b){
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__m128i noiseHash4(__m128i x, __m128i y, __m128i seed){
+	__m128i h = _mm_xor_si128(noiseMultiply(x, _mm_set1_epi32(0x27d4eb2d)), noiseMultiply(y, _mm_set1_epi32(0x165667b1)));
+	h = _mm_xor_si128(h, seed);
+	h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+	h = noiseMultiply(h, _mm_set1_epi32(0x2c1b3c6d));
+	return _mm_xor_si128(h, _mm_srli_epi32(h, 12));
+}
+
+// flips the sign bit of x and y where the hash bits say so
+__m128 noiseGradient4(__m128i hash, __m128 x, __m128 y){
+	__m128i xSign = _mm_slli_epi32(hash, 31);
+	__m128i ySign = _mm_slli_epi32(_mm_srli_epi32(hash, 1), 31);
+	return _mm_add_ps(_mm_xor_ps(x, _mm_castsi128_ps(xSign)), _mm_xor_ps(y, _mm_castsi128_ps(ySign)));
+}
+
+__m128 noiseFade4(__m128 t){
+	__m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f));
+	return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+__m128i noiseFloor4(__m128 x){
+	__m128i truncated = _mm_cvttps_epi32(x);
+	// truncation rounds negatives up, step those back down
+	__m128 isAbove = _mm_cmpgt_ps(_mm_cvtepi32_ps(truncated), x);
+	return _mm_add_epi32(truncated, _mm_castps_si128(isAbove));
+}
+
+__m128 fNoise4(__m128 x, __m128 y, __m128i seed){
+	__m128i ix = noiseFloor4(x);
+	__m128i iy = noiseFloor4(y);
+	__m128i ix1 = _mm_add_epi32(ix, _mm_set1_epi32(1));
+	__m128i iy1 = _mm_add_epi32(iy, _mm_set1_epi32(1));
+	__m128 fx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix));
+	__m128 fy = _mm_sub_ps(y, _mm_cvtepi32_ps(iy));
+	__m128 fx1 = _mm_sub_ps(fx, _mm_set1_ps(1.0f));
+	__m128 fy1 = _mm_sub_ps(fy, _mm_set1_ps(1.0f));
+
+	__m128 g00 = noiseGradient4(noiseHash4(ix, iy, seed), fx, fy);
+	__m128 g10 = noiseGradient4(noiseHash4(ix1, iy, seed), fx1, fy);
+	__m128 g01 = noiseGradient4(noiseHash4(ix, iy1, seed), fx, fy1);
+	__m128 g11 = noiseGradient4(noiseHash4(ix1, iy1, seed), fx1, fy1);
+
+	__m128 u = noiseFade4(fx);
+	__m128 v = noiseFade4(fy);
+	__m128 top = _mm_add_ps(g00, _mm_mul_ps(_mm_sub_ps(g10, g00), u));
+	__m128 bottom = _mm_add_ps(g01, _mm_mul_ps(_mm_sub_ps(g11, g01), u));
+	return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), v));
+}
+#endif
+
+// count samples at x0, x0 + stepX, ... along one y
+void fNoiseRowScalar(float* out, int count, float x0, float stepX, float y, unsigned int seed){
+	for (int i = 0; i < count; i++){
+		out[i] = fNoise(x0 + i * stepX, y, seed);
+	}
+}
+
+void fNoiseRow(float* out, int count, float x0, float stepX, float y, unsigned int seed){
+	int i = 0;
+#ifdef __SSE2__
+	__m128 ys = _mm_set1_ps(y);
+	__m128i seeds = _mm_set1_epi32(seed);
+	__m128 offsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	for (; i + 4 <= count; i += 4){
+		__m128 xs = _mm_add_ps(_mm_set1_ps(x0), _mm_mul_ps(_mm_add_ps(_mm_set1_ps(i), offsets), _mm_set1_ps(stepX)));
+		_mm_storeu_ps(out + i, fNoise4(xs, ys, seeds));
+	}
+#endif
+	for (; i < count; i++){
+		out[i] = fNoise(x0 + i * stepX, y, seed);
+	}
+}
+
 //------------------------------------------------------
 // sprites
 //------------------------------------------------------
@@ -65,7 +239,7 @@ typedef struct FrameworkSpriteSheet FrameworkSpriteSheet;
 FrameworkSpriteSheet mainSpriteSheet;
 FrameworkSpriteSheet initSpriteSheet(){
 	FrameworkSpriteSheet out;
-	out.spriteSheetTexture = LoadTexture("resources/spritesheet.png");
+	out.spriteSheetTexture = LoadTexture(SPRITESHEET_PATH);
 	out.width = out.spriteSheetTexture.width / DEFAULT_SPRITE_SIZE;
 	out.height = out.spriteSheetTexture.height / DEFAULT_SPRITE_SIZE;
 	
@@ -110,10 +284,96 @@ void updateCamera(){
 
 }
 
+//------------------------------------------------------
+// draw commands
+//------------------------------------------------------
+// the game records its draw calls into one list while the main thread replays the other
+#define MAX_DRAW_COMMANDS 4096
+#define MAX_DRAW_TEXTS 64
+#define DRAW_TEXT_LENGTH 32
+
+#define DRAW_COMMAND_SPRITE 0
+#define DRAW_COMMAND_TEXT 1
+#define DRAW_COMMAND_CLEAR 2
+
+struct DrawCommand{
+	int type;
+	// sprite index, or text index for text commands
+	int index;
+	int x;
+	int y;
+	int scale;
+	Color color;
+};
+typedef struct DrawCommand DrawCommand;
+
+struct DrawList{
+	DrawCommand commands[MAX_DRAW_COMMANDS];
+	int commandCount;
+	char texts[MAX_DRAW_TEXTS][DRAW_TEXT_LENGTH];
+	int textCount;
+	Camera2D camera;
+	int droppedCommands;
+};
+typedef struct DrawList DrawList;
+
+DrawList drawLists[2];
+int recordingList = 0;
+
+void recordCommand(int type, int index, int x, int y, int scale, Color c){
+	DrawList* list = &drawLists[recordingList];
+	if (list->commandCount >= MAX_DRAW_COMMANDS){
+		list->droppedCommands++;
+		return;
+	}
+	DrawCommand command = {type, index, x, y, scale, c};
+	list->commands[list->commandCount++] = command;
+}
+
 //------------------------------------------------------
 // drawing
 //------------------------------------------------------
 void drawC(int spriteIndex, int x, int y, Color c){
+	recordCommand(DRAW_COMMAND_SPRITE, spriteIndex, x, y, 1, c);
+}
+
+void draw(int spriteIndex, int x, int y){	
+	drawC(spriteIndex, x, y, WHITE);
+}
+
+void drawFancyText(const char* text, int x, int y, int scale, Color color){
+	DrawList* list = &drawLists[recordingList];
+	if (list->textCount >= MAX_DRAW_TEXTS){
+		list->droppedCommands++;
+		return;
+	}
+	strncpy(list->texts[list->textCount], text, DRAW_TEXT_LENGTH - 1);
+	list->texts[list->textCount][DRAW_TEXT_LENGTH - 1] = '\0';
+	recordCommand(DRAW_COMMAND_TEXT, list->textCount, x, y, scale, color);
+	list->textCount++;
+}
+
+void fClear(Color c){
+	recordCommand(DRAW_COMMAND_CLEAR, 0, 0, 0, 1, c);
+}
+
+void fDrawBegin(){
+	DrawList* list = &drawLists[recordingList];
+	list->commandCount = 0;
+	list->textCount = 0;
+	list->droppedCommands = 0;
+
+	list->camera = cam;
+}
+
+void fDrawEnd(){
+	// the list is handed to the main thread once the frame callback returns
+}
+
+//------------------------------------------------------
+// replay
+//------------------------------------------------------
+void replaySprite(int spriteIndex, int x, int y, Color c){
 	Rectangle src = {(spriteIndex % loadedSheet.width) * DEFAULT_SPRITE_SIZE, floor((float)spriteIndex / (float)loadedSheet.width) *
 	DEFAULT_SPRITE_SIZE, DEFAULT_SPRITE_SIZE, DEFAULT_SPRITE_SIZE};
 	Rectangle dest = {x, y, DEFAULT_SPRITE_SIZE, DEFAULT_SPRITE_SIZE};
@@ -122,59 +382,1389 @@ void drawC(int spriteIndex, int x, int y, Color c){
 	DrawTexturePro(loadedSheet.spriteSheetTexture, src, dest, origin, 0.0f, c);
 }
 
-void draw(int spriteIndex, int x, int y){	
-	drawC(spriteIndex, x, y, WHITE);
+void replayText(const char* text, int x, int y, int scale, Color color){
+	int shadowOffset = fmax(scale / 10.0f, 1);
+	DrawText(text, x + shadowOffset, y, scale, GRAY);
+	DrawText(text, x, y, scale, color);
 }
 
+void captureRenderTexture();
 
+void replayDrawList(const DrawList* list){
+	BeginTextureMode(renderTexture);
+	BeginMode2D(list->camera);
 
+	for (int i = 0; i < list->commandCount; i++){
+		const DrawCommand* command = &list->commands[i];
+		switch (command->type){
+			case DRAW_COMMAND_SPRITE: replaySprite(command->index, command->x, command->y, command->color); break;
+			case DRAW_COMMAND_TEXT: replayText(list->texts[command->index], command->x, command->y, command->scale, command->color); break;
+			case DRAW_COMMAND_CLEAR: ClearBackground(command->color); break;
+		}
+	}
 
-void fDrawBegin(){
-	BeginTextureMode(renderTexture);
-    BeginMode2D(cam);
+	EndMode2D();
+	captureRenderTexture();
+	EndTextureMode();
+
+	BeginDrawing();
+	ClearBackground(BLACK);
+	Rectangle r = { 0, 0, (float)(renderTexture.texture.width), (float)(-renderTexture.texture.height) };
+	Rectangle r2 = { renderTextureOffset, 0, (float)(GetScreenWidth()) * scalingFactor, (float)(GetScreenHeight()) };
+	Vector2 v = {0, 0};
+	DrawTexturePro(renderTexture.texture,r,r2,v,0,WHITE);
+
+	EndDrawing();
+}
+
+//------------------------------------------------------
+// software renderer
+//------------------------------------------------------
+// CPU backend for --headless, renders the unzoomed 640x360 view into an RGBA8 framebuffer
+#define SOFTWARE_WIDTH 640
+#define SOFTWARE_HEIGHT 360
+
+unsigned char* softwareFramebuffer;
+Image softwareSheet;
+int softwareFrame = 0;
+
+// x / 255 for x <= 255 * 255
+unsigned int div255(unsigned int x){
+	return (x + 1 + (x >> 8)) >> 8;
+}
+
+void softwareBlendPixel(unsigned char* dst, const unsigned char* src, Color tint){
+	unsigned int alpha = div255(src[3] * tint.a);
+	if (alpha == 0){
+		return;
+	}
+	dst[0] = div255(div255(src[0] * tint.r) * alpha + dst[0] * (255 - alpha));
+	dst[1] = div255(div255(src[1] * tint.g) * alpha + dst[1] * (255 - alpha));
+	dst[2] = div255(div255(src[2] * tint.b) * alpha + dst[2] * (255 - alpha));
+	dst[3] = 255;
+}
+
+#ifdef __SSE2__
+__m128i div255x8(__m128i x){
+	x = _mm_add_epi16(x, _mm_add_epi16(_mm_set1_epi16(1), _mm_srli_epi16(x, 8)));
+	return _mm_srli_epi16(x, 8);
+}
+
+// two pixels widened to 16 bit lanes, tinted and blended over dst
+__m128i blendPixels2(__m128i src, __m128i dst, __m128i tint){
+	src = div255x8(_mm_mullo_epi16(src, tint));
+	__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(src, 0xff), 0xff);
+	__m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+	return div255x8(_mm_add_epi16(_mm_mullo_epi16(src, alpha), _mm_mullo_epi16(dst, inverse)));
+}
+#endif
+
+void softwareBlendSpan(unsigned char* dst, const unsigned char* src, int count, Color tint){
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alphaBits = _mm_set1_epi32(0xff000000);
+	const __m128i tint16 = _mm_setr_epi16(tint.r, tint.g, tint.b, tint.a, tint.r, tint.g, tint.b, tint.a);
+	bool isUntinted = tint.r == 255 && tint.g == 255 && tint.b == 255 && tint.a == 255;
+
+	for (; i + 4 <= count; i += 4){
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		__m128i alpha = _mm_and_si128(s, alphaBits);
+
+		// fully transparent or fully opaque runs skip the blend
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xffff){
+			continue;
+		}
+		if (isUntinted && _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaBits)) == 0xffff){
+			_mm_storeu_si128((__m128i*)(dst + i * 4), s);
+			continue;
+		}
+
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i * 4));
+		__m128i low = blendPixels2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero), tint16);
+		__m128i high = blendPixels2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero), tint16);
+		__m128i out = _mm_or_si128(_mm_packus_epi16(low, high), alphaBits);
+		_mm_storeu_si128((__m128i*)(dst + i * 4), out);
+	}
+#endif
+	for (; i < count; i++){
+		softwareBlendPixel(dst + i * 4, src + i * 4, tint);
+	}
+}
+
+void softwareDrawSprite(int spriteIndex, int x, int y, Color tint){
+	int srcX = (spriteIndex % loadedSheet.width) * DEFAULT_SPRITE_SIZE;
+	int srcY = (spriteIndex / loadedSheet.width) * DEFAULT_SPRITE_SIZE;
+	if (spriteIndex < 0 || srcY + DEFAULT_SPRITE_SIZE > softwareSheet.height){
+		return;
+	}
+
+	int left = fmax(x, 0);
+	int right = fmin(x + DEFAULT_SPRITE_SIZE, SOFTWARE_WIDTH);
+	int top = fmax(y, 0);
+	int bottom = fmin(y + DEFAULT_SPRITE_SIZE, SOFTWARE_HEIGHT);
+	if (left >= right || top >= bottom){
+		return;
+	}
+
+	const unsigned char* sheet = softwareSheet.data;
+	for (int row = top; row < bottom; row++){
+		unsigned char* dst = softwareFramebuffer + (row * SOFTWARE_WIDTH + left) * 4;
+		const unsigned char* src = sheet + ((srcY + row - y) * softwareSheet.width + srcX + left - x) * 4;
+		softwareBlendSpan(dst, src, right - left, tint);
+	}
+}
+
+void softwareFillRect(int x, int y, int w, int h, Color c){
+	unsigned char pixel[4] = {c.r, c.g, c.b, 255};
+	for (int row = fmax(y, 0); row < fmin(y + h, SOFTWARE_HEIGHT); row++){
+		for (int column = fmax(x, 0); column < fmin(x + w, SOFTWARE_WIDTH); column++){
+			softwareBlendPixel(softwareFramebuffer + (row * SOFTWARE_WIDTH + column) * 4, pixel, WHITE);
+		}
+	}
+}
+
+// raylib's default font only exists on the GPU, so glyphs are drawn as solid boxes of the same metrics
+void softwareDrawText(const char* text, int x, int y, int scale, Color color){
+	int size = fmax(scale, 10);
+	int spacing = size / 10;
+	int shadowOffset = fmax(scale / 10.0f, 1);
+	int glyphWidth = size / 2;
+
+	for (int i = 0; text[i] != '\0'; i++){
+		int glyphX = x + i * (glyphWidth + spacing);
+		if (text[i] != ' '){
+			softwareFillRect(glyphX + shadowOffset, y + size / 5, glyphWidth, size * 7 / 10, GRAY);
+			softwareFillRect(glyphX, y + size / 5, glyphWidth, size * 7 / 10, color);
+		}
+	}
+}
+
+void softwareClear(Color c){
+	unsigned char pixel[4] = {c.r, c.g, c.b, 255};
+	for (int i = 0; i < SOFTWARE_WIDTH; i++){
+		memcpy(softwareFramebuffer + i * 4, pixel, 4);
+	}
+	for (int row = 1; row < SOFTWARE_HEIGHT; row++){
+		memcpy(softwareFramebuffer + row * SOFTWARE_WIDTH * 4, softwareFramebuffer, SOFTWARE_WIDTH * 4);
+	}
+}
+
+unsigned long long hashFramebuffer(){
+	// FNV-1a over 64 bit words
+	unsigned long long hash = 14695981039346656037ULL;
+	const unsigned long long* words = (const unsigned long long*)softwareFramebuffer;
+	for (int i = 0; i < SOFTWARE_WIDTH * SOFTWARE_HEIGHT / 2; i++){
+		hash ^= words[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+void softwareReplayDrawList(const DrawList* list){
+	// the camera only shakes, zoom is baked into the framebuffer size
+	int offsetX = -roundf(list->camera.target.x);
+	int offsetY = -roundf(list->camera.target.y);
+
+	for (int i = 0; i < list->commandCount; i++){
+		const DrawCommand* command = &list->commands[i];
+		switch (command->type){
+			case DRAW_COMMAND_SPRITE: softwareDrawSprite(command->index, command->x + offsetX, command->y + offsetY, command->color); break;
+			case DRAW_COMMAND_TEXT: softwareDrawText(list->texts[command->index], command->x + offsetX, command->y + offsetY, command->scale, command->color); break;
+			case DRAW_COMMAND_CLEAR: softwareClear(command->color); break;
+		}
+	}
+
+	if (fFrameDirectory != NULL){
+		char path[512];
+		snprintf(path, sizeof(path), "%s/frame_%06i.png", fFrameDirectory, softwareFrame);
+		Image frame = {softwareFramebuffer, SOFTWARE_WIDTH, SOFTWARE_HEIGHT, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+		ExportImage(frame, path);
+	}
+	if (fPrintFrameHashes){
+		printf("frame %06i %016llx\n", softwareFrame, hashFramebuffer());
+	}
+	softwareFrame++;
+}
+
+//------------------------------------------------------
+// capture
+//------------------------------------------------------
+// finished frames are copied into a fixed pool of buffers and handed to an encoder thread through
+// lock-free single producer queues, the render loop drops a frame rather than wait for the encoder.
+// the encoder lives for the whole run and owns the file, F9 only queues a start or stop marker
+// behind the frames, so opening, draining and flushing a recording never stall the render loop
+#define CAPTURE_BUFFERS 8
+#define CAPTURE_QUEUE_SIZE 16
+#define CAPTURE_PATH_LENGTH 256
+// markers sharing the queue with buffer indices
+#define CAPTURE_MARKER_STOP -1
+#define CAPTURE_MARKER_START -2
+
+struct CaptureBuffer{
+	unsigned char* pixels;
+	bool isFlipped;
+};
+typedef struct CaptureBuffer CaptureBuffer;
+
+struct CaptureQueue{
+	int slots[CAPTURE_QUEUE_SIZE];
+	atomic_uint head;
+	atomic_uint tail;
+};
+typedef struct CaptureQueue CaptureQueue;
+
+CaptureBuffer captureBuffers[CAPTURE_BUFFERS];
+// buffers the render loop may fill, and buffers or markers waiting for the encoder
+CaptureQueue freeCaptureBuffers;
+CaptureQueue filledCaptureBuffers;
+sem_t captureFramesReady;
+pthread_t encoderThread;
+atomic_bool isEncoderRunning;
+bool hasEncoder = false;
+int captureWidth;
+int captureHeight;
+int captureFrameRate;
+
+// render thread side
+bool isRecording = false;
+int capturedFrames = 0;
+int captureNumber = 0;
+int fCaptureDroppedFrames = 0;
+// one path per queued start marker, a start can't be overwritten before the encoder pops it
+// because there are never more markers in flight than queue slots
+char capturePaths[CAPTURE_QUEUE_SIZE][CAPTURE_PATH_LENGTH];
+int captureStarts = 0;
+
+// encoder thread side
+FILE* captureFile = NULL;
+unsigned char* capturePlanes;
+int encodedFrames = 0;
+int encodedStarts = 0;
+
+bool pushCaptureQueue(CaptureQueue* queue, int value){
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	if (tail - atomic_load_explicit(&queue->head, memory_order_acquire) == CAPTURE_QUEUE_SIZE){
+		return false;
+	}
+	queue->slots[tail % CAPTURE_QUEUE_SIZE] = value;
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+bool popCaptureQueue(CaptureQueue* queue, int* value){
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	if (head == atomic_load_explicit(&queue->tail, memory_order_acquire)){
+		return false;
+	}
+	*value = queue->slots[head % CAPTURE_QUEUE_SIZE];
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+	return true;
+}
+
+bool isCapturing(){
+	return isRecording;
+}
+
+// RGBA to 4:2:0 YCbCr with full range BT.601 coefficients, chroma averaged over 2x2 blocks
+void encodeY4mFrame(const CaptureBuffer* buffer){
+	int w = captureWidth;
+	int h = captureHeight;
+	unsigned char* luma = capturePlanes;
+	unsigned char* cb = luma + w * h;
+	unsigned char* cr = cb + (w / 2) * (h / 2);
+
+	for (int y = 0; y < h; y++){
+		const unsigned char* row = buffer->pixels + (buffer->isFlipped ? h - 1 - y : y) * w * 4;
+		for (int x = 0; x < w; x++){
+			const unsigned char* p = row + x * 4;
+			luma[y * w + x] = (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+		}
+	}
+
+	for (int y = 0; y < h / 2; y++){
+		const unsigned char* top = buffer->pixels + (buffer->isFlipped ? h - 1 - y * 2 : y * 2) * w * 4;
+		const unsigned char* bottom = top + (buffer->isFlipped ? -w * 4 : w * 4);
+		for (int x = 0; x < w / 2; x++){
+			const unsigned char* a = top + x * 8;
+			const unsigned char* b = bottom + x * 8;
+			int r = (a[0] + a[4] + b[0] + b[4]) / 4;
+			int g = (a[1] + a[5] + b[1] + b[5]) / 4;
+			int bl = (a[2] + a[6] + b[2] + b[6]) / 4;
+			cb[y * (w / 2) + x] = ((-43 * r - 85 * g + 128 * bl) >> 8) + 128;
+			cr[y * (w / 2) + x] = ((128 * r - 107 * g - 21 * bl) >> 8) + 128;
+		}
+	}
+
+	fputs("FRAME\n", captureFile);
+	fwrite(capturePlanes, 1, w * h + (w / 2) * (h / 2) * 2, captureFile);
+}
+
+void openCaptureFile(const char* path){
+	captureFile = fopen(path, "wb");
+	if (captureFile == NULL){
+		TraceLog(LOG_WARNING, "CAPTURE: Can't open %s", path);
+		return;
+	}
+	fprintf(captureFile, "YUV4MPEG2 W%i H%i F%i:1 Ip A1:1 C420jpeg\n", captureWidth, captureHeight, captureFrameRate);
+	encodedFrames = 0;
+	TraceLog(LOG_INFO, "CAPTURE: Recording to %s", path);
+}
+
+void closeCaptureFile(){
+	if (captureFile == NULL){
+		return;
+	}
+	fclose(captureFile);
+	captureFile = NULL;
+	TraceLog(LOG_INFO, "CAPTURE: %i frames written", encodedFrames);
+}
+
+void* encoderThreadMain(void* arg){
+	while (true){
+		sem_wait(&captureFramesReady);
+
+		int index;
+		if (!popCaptureQueue(&filledCaptureBuffers, &index)){
+			// woken up with nothing queued means the run is over and the queue is drained
+			if (!atomic_load(&isEncoderRunning)){
+				break;
+			}
+			continue;
+		}
+		if (index == CAPTURE_MARKER_START){
+			closeCaptureFile();
+			openCaptureFile(capturePaths[encodedStarts++ % CAPTURE_QUEUE_SIZE]);
+		}else if (index == CAPTURE_MARKER_STOP){
+			closeCaptureFile();
+		}else {
+			// a file that failed to open still hands its buffers back
+			if (captureFile != NULL){
+				encodeY4mFrame(&captureBuffers[index]);
+				encodedFrames++;
+			}
+			pushCaptureQueue(&freeCaptureBuffers, index);
+		}
+	}
+	closeCaptureFile();
+	return NULL;
+}
+
+// buffers and the encoder are set up once per run, so toggling a recording never allocates
+void startCaptureEncoder(){
+	captureWidth = fHeadless ? SOFTWARE_WIDTH : SCREEN_WIDTH;
+	captureHeight = fHeadless ? SOFTWARE_HEIGHT : SCREEN_HEIGHT;
+	int frameRate = fHeadless ? TICK_RATE : GetMonitorRefreshRate(GetCurrentMonitor());
+	captureFrameRate = frameRate > 0 ? frameRate : TICK_RATE;
+
+	atomic_init(&freeCaptureBuffers.head, 0);
+	atomic_init(&freeCaptureBuffers.tail, 0);
+	atomic_init(&filledCaptureBuffers.head, 0);
+	atomic_init(&filledCaptureBuffers.tail, 0);
+	for (int i = 0; i < CAPTURE_BUFFERS; i++){
+		captureBuffers[i].pixels = malloc(captureWidth * captureHeight * 4);
+		pushCaptureQueue(&freeCaptureBuffers, i);
+	}
+	capturePlanes = malloc(captureWidth * captureHeight * 2);
+
+	sem_init(&captureFramesReady, 0, 0);
+	atomic_store(&isEncoderRunning, true);
+	pthread_create(&encoderThread, NULL, encoderThreadMain, NULL);
+	hasEncoder = true;
+}
+
+// shutdown only, waits for queued frames to be written
+void stopCaptureEncoder(){
+	if (!hasEncoder){
+		return;
+	}
+	isRecording = false;
+	atomic_store(&isEncoderRunning, false);
+	sem_post(&captureFramesReady);
+	pthread_join(encoderThread, NULL);
+	sem_destroy(&captureFramesReady);
+	hasEncoder = false;
+
+	for (int i = 0; i < CAPTURE_BUFFERS; i++){
+		free(captureBuffers[i].pixels);
+	}
+	free(capturePlanes);
+}
+
+bool pushCaptureMarker(int marker){
+	if (!pushCaptureQueue(&filledCaptureBuffers, marker)){
+		TraceLog(LOG_WARNING, "CAPTURE: Encoder is behind, try again");
+		return false;
+	}
+	sem_post(&captureFramesReady);
+	return true;
+}
+
+void startCapture(const char* path){
+	if (isRecording){
+		return;
+	}
+	snprintf(capturePaths[captureStarts % CAPTURE_QUEUE_SIZE], CAPTURE_PATH_LENGTH, "%s", path);
+	if (!pushCaptureMarker(CAPTURE_MARKER_START)){
+		return;
+	}
+	captureStarts++;
+	capturedFrames = 0;
+	fCaptureDroppedFrames = 0;
+	isRecording = true;
+}
+
+// returns at once, the encoder finishes the file behind the queued frames
+void stopCapture(){
+	if (!isRecording || !pushCaptureMarker(CAPTURE_MARKER_STOP)){
+		return;
+	}
+	isRecording = false;
+	TraceLog(LOG_INFO, "CAPTURE: Stopped, %i frames queued, %i dropped", capturedFrames, fCaptureDroppedFrames);
+}
+
+void toggleCapture(){
+	if (isCapturing()){
+		stopCapture();
+		return;
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "capture_%03i.y4m", captureNumber++);
+	startCapture(path);
+}
+
+// takes a free buffer or drops the frame, never waits for the encoder
+CaptureBuffer* acquireCaptureBuffer(int* index){
+	if (!popCaptureQueue(&freeCaptureBuffers, index)){
+		fCaptureDroppedFrames++;
+		return NULL;
+	}
+	return &captureBuffers[*index];
+}
+
+void submitCaptureBuffer(int index){
+	pushCaptureQueue(&filledCaptureBuffers, index);
+	sem_post(&captureFramesReady);
+	capturedFrames++;
+}
+
+// called with renderTexture bound, GL keeps it bottom up
+void captureRenderTexture(){
+	int index;
+	CaptureBuffer* buffer;
+	if (!isCapturing() || (buffer = acquireCaptureBuffer(&index)) == NULL){
+		return;
+	}
+	rlDrawRenderBatchActive();
+	glReadPixels(0, 0, captureWidth, captureHeight, GL_RGBA, GL_UNSIGNED_BYTE, buffer->pixels);
+	buffer->isFlipped = true;
+	submitCaptureBuffer(index);
+}
+
+void captureSoftwareFramebuffer(){
+	int index;
+	CaptureBuffer* buffer;
+	if (!isCapturing() || (buffer = acquireCaptureBuffer(&index)) == NULL){
+		return;
+	}
+	memcpy(buffer->pixels, softwareFramebuffer, captureWidth * captureHeight * 4);
+	buffer->isFlipped = false;
+	submitCaptureBuffer(index);
+}
+
+//------------------------------------------------------
+// input
+//------------------------------------------------------
+// raylib polls input on the main thread, the game reads a copy taken between frames
+#define F_MAX_KEYS 512
+bool keysDown[F_MAX_KEYS];
+bool keysPressed[F_MAX_KEYS];
+
+// presses are kept until a tick has seen them, frames without a tick don't lose input
+void captureInput(){
+	for (int i = 0; i < F_MAX_KEYS; i++){
+		keysDown[i] = IsKeyDown(i);
+		keysPressed[i] |= IsKeyPressed(i);
+	}
+}
+
+bool fIsKeyDown(int key){
+	return key >= 0 && key < F_MAX_KEYS && keysDown[key];
+}
+
+bool fIsKeyPressed(int key){
+	return key >= 0 && key < F_MAX_KEYS && keysPressed[key];
+}
+
+//------------------------------------------------------
+// telemetry
+//------------------------------------------------------
+// counters are bumped in plain memory while a frame is simulated and copied into the
+// shared segment once per frame, readers retry instead of ever blocking the game
+TelemetryCounters fTelemetry = {0};
+TelemetrySegment* telemetrySegment = NULL;
+
+void startTelemetry(const char* name){
+#ifdef __linux__
+	int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(TelemetrySegment)) != 0){
+		TraceLog(LOG_WARNING, "TELEMETRY: Can't create %s", name);
+		if (fd >= 0){
+			close(fd);
+		}
+		return;
+	}
+
+	void* memory = mmap(NULL, sizeof(TelemetrySegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED){
+		TraceLog(LOG_WARNING, "TELEMETRY: Can't map %s", name);
+		return;
+	}
+	telemetrySegment = memory;
+	// a killed instance leaves its segment behind, possibly with an odd sequence mid publish
+	atomic_store(&telemetrySegment->sequence, 0);
+	memset(&telemetrySegment->counters, 0, sizeof(telemetrySegment->counters));
+	telemetrySegment->version = TELEMETRY_VERSION;
+	TraceLog(LOG_INFO, "TELEMETRY: Publishing to %s", name);
+#endif
+}
+
+void stopTelemetry(){
+#ifdef __linux__
+	if (telemetrySegment == NULL){
+		return;
+	}
+	munmap(telemetrySegment, sizeof(TelemetrySegment));
+	shm_unlink(fTelemetryName);
+	telemetrySegment = NULL;
+#endif
+}
+
+// main thread only, while the simulation is parked
+void publishTelemetry(){
+	if (telemetrySegment == NULL){
+		return;
+	}
+	unsigned int sequence = atomic_load_explicit(&telemetrySegment->sequence, memory_order_relaxed);
+	atomic_store_explicit(&telemetrySegment->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	telemetrySegment->counters = fTelemetry;
+	atomic_store_explicit(&telemetrySegment->sequence, sequence + 2, memory_order_release);
+}
+
+void fPlaySound(Sound sound){
+	fTelemetry.soundsPlayed++;
+	PlaySound(sound);
+}
+
+//------------------------------------------------------
+// network
+//------------------------------------------------------
+// length prefixed messages over TCP, a server broadcasts to spectators and a spectator
+// reads them back, what goes into a message is up to the game
+#define NET_DEFAULT_PORT 24680
+#define NET_MAX_CLIENTS 8
+#define NET_MESSAGE_SIZE 16384
+// per connection, a spectator that falls this far behind is dropped
+#define NET_STREAM_SIZE (NET_MESSAGE_SIZE * 16)
+
+struct NetBuffer{
+	unsigned char data[NET_MESSAGE_SIZE];
+	int length;
+	int position;
+	// overflowed while writing or ran past the end while reading
+	bool isBroken;
+};
+typedef struct NetBuffer NetBuffer;
+
+void netWriteByte(NetBuffer* buffer, unsigned char value){
+	if (buffer->length >= NET_MESSAGE_SIZE){
+		buffer->isBroken = true;
+		return;
+	}
+	buffer->data[buffer->length++] = value;
+}
+
+// 7 bits per byte, the high bit marks that more follow
+void netWriteVarint(NetBuffer* buffer, unsigned int value){
+	while (value >= 0x80){
+		netWriteByte(buffer, (value & 0x7f) | 0x80);
+		value >>= 7;
+	}
+	netWriteByte(buffer, value);
+}
+
+// zigzag, small negative numbers stay small
+void netWriteSigned(NetBuffer* buffer, int value){
+	netWriteVarint(buffer, ((unsigned int)value << 1) ^ (unsigned int)(value >> 31));
+}
+
+unsigned char netReadByte(NetBuffer* buffer){
+	if (buffer->position >= buffer->length){
+		buffer->isBroken = true;
+		return 0;
+	}
+	return buffer->data[buffer->position++];
+}
+
+unsigned int netReadVarint(NetBuffer* buffer){
+	unsigned int value = 0;
+	for (int shift = 0; shift < 35; shift += 7){
+		unsigned char byte = netReadByte(buffer);
+		value |= (unsigned int)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0){
+			return value;
+		}
+	}
+	buffer->isBroken = true;
+	return value;
+}
+
+int netReadSigned(NetBuffer* buffer){
+	unsigned int value = netReadVarint(buffer);
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+struct NetClient{
+	int socket;
+	bool needsKeyframe;
+	unsigned char pending[NET_STREAM_SIZE];
+	int pendingLength;
+};
+typedef struct NetClient NetClient;
+
+NetClient netClients[NET_MAX_CLIENTS];
+int netClientCount = 0;
+int netListenSocket = -1;
+// spectator side
+int netServerSocket = -1;
+unsigned char netStream[NET_STREAM_SIZE];
+int netStreamLength = 0;
+
+#ifdef __linux__
+void setNonBlocking(int socket){
+	fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+	int noDelay = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+}
+#endif
+
+void startServer(int port){
+#ifdef __linux__
+	netListenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(netListenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	struct sockaddr_in address = {0};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (netListenSocket < 0 || bind(netListenSocket, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(netListenSocket, NET_MAX_CLIENTS) != 0){
+		TraceLog(LOG_WARNING, "NET: Can't listen on port %i", port);
+		if (netListenSocket >= 0){
+			close(netListenSocket);
+		}
+		netListenSocket = -1;
+		return;
+	}
+	fcntl(netListenSocket, F_SETFL, O_NONBLOCK);
+	TraceLog(LOG_INFO, "NET: Serving spectators on port %i", port);
+#endif
+}
+
+// host or host:port
+void connectToServer(const char* address){
+#ifdef __linux__
+	char host[256];
+	snprintf(host, sizeof(host), "%s", address);
+	char port[16];
+	snprintf(port, sizeof(port), "%i", NET_DEFAULT_PORT);
+	char* separator = strrchr(host, ':');
+	if (separator != NULL){
+		*separator = '\0';
+		snprintf(port, sizeof(port), "%s", separator + 1);
+	}
+
+	struct addrinfo hints = {0};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* results = NULL;
+	if (getaddrinfo(host, port, &hints, &results) != 0){
+		TraceLog(LOG_WARNING, "NET: Can't resolve %s", address);
+		return;
+	}
+	for (struct addrinfo* r = results; r != NULL && netServerSocket < 0; r = r->ai_next){
+		netServerSocket = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+		if (netServerSocket >= 0 && connect(netServerSocket, r->ai_addr, r->ai_addrlen) != 0){
+			close(netServerSocket);
+			netServerSocket = -1;
+		}
+	}
+	freeaddrinfo(results);
+
+	if (netServerSocket < 0){
+		TraceLog(LOG_WARNING, "NET: Can't connect to %s", address);
+		return;
+	}
+	setNonBlocking(netServerSocket);
+	TraceLog(LOG_INFO, "NET: Spectating %s", address);
+#endif
+}
+
+void dropClient(int index){
+#ifdef __linux__
+	close(netClients[index].socket);
+#endif
+	netClients[index] = netClients[--netClientCount];
+	TraceLog(LOG_INFO, "NET: Spectator left, %i watching", netClientCount);
+}
+
+void stopNetwork(){
+#ifdef __linux__
+	while (netClientCount > 0){
+		dropClient(netClientCount - 1);
+	}
+	if (netListenSocket >= 0){
+		close(netListenSocket);
+		netListenSocket = -1;
+	}
+	if (netServerSocket >= 0){
+		close(netServerSocket);
+		netServerSocket = -1;
+	}
+#endif
+}
+
+bool fNetIsServing(){
+	return netListenSocket >= 0;
+}
+
+// new spectators start out wanting a keyframe
+void fNetAcceptClients(){
+#ifdef __linux__
+	if (netListenSocket < 0){
+		return;
+	}
+	int socket;
+	while ((socket = accept(netListenSocket, NULL, NULL)) >= 0){
+		if (netClientCount >= NET_MAX_CLIENTS){
+			close(socket);
+			continue;
+		}
+		setNonBlocking(socket);
+		NetClient* client = &netClients[netClientCount++];
+		client->socket = socket;
+		client->needsKeyframe = true;
+		client->pendingLength = 0;
+		TraceLog(LOG_INFO, "NET: Spectator joined, %i watching", netClientCount);
+	}
+#endif
+}
+
+bool fNetNeedsKeyframe(){
+	for (int i = 0; i < netClientCount; i++){
+		if (netClients[i].needsKeyframe){
+			return true;
+		}
+	}
+	return false;
+}
+
+void fNetRequestKeyframes(){
+	for (int i = 0; i < netClientCount; i++){
+		netClients[i].needsKeyframe = true;
+	}
+}
+
+bool queueMessage(NetClient* client, const NetBuffer* message){
+	NetBuffer header = {0};
+	netWriteVarint(&header, message->length);
+	if (client->pendingLength + header.length + message->length > NET_STREAM_SIZE){
+		return false;
+	}
+	memcpy(client->pending + client->pendingLength, header.data, header.length);
+	memcpy(client->pending + client->pendingLength + header.length, message->data, message->length);
+	client->pendingLength += header.length + message->length;
+	return true;
+}
+
+bool flushClient(NetClient* client){
+#ifdef __linux__
+	int sent = 0;
+	while (sent < client->pendingLength){
+		ssize_t count = send(client->socket, client->pending + sent, client->pendingLength - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (count < 0){
+			if (errno == EAGAIN || errno == EWOULDBLOCK){
+				break;
+			}
+			return false;
+		}
+		sent += count;
+	}
+	memmove(client->pending, client->pending + sent, client->pendingLength - sent);
+	client->pendingLength -= sent;
+#endif
+	return true;
+}
+
+// keyframe goes to spectators that asked for one, the delta to everyone else
+void fNetBroadcast(const NetBuffer* delta, const NetBuffer* keyframe){
+	for (int i = 0; i < netClientCount;){
+		NetClient* client = &netClients[i];
+		bool isQueued = true;
+		if (client->needsKeyframe && keyframe != NULL){
+			isQueued = queueMessage(client, keyframe);
+			client->needsKeyframe = false;
+		}else if (!client->needsKeyframe && delta->length > 0){
+			isQueued = queueMessage(client, delta);
+		}
+
+		if (!isQueued || !flushClient(client)){
+			dropClient(i);
+			continue;
+		}
+		i++;
+	}
+}
+
+bool fNetIsSpectating(){
+	return netServerSocket >= 0;
+}
+
+// copies the next whole message out of the stream, reading more from the socket when needed
+bool fNetReceive(NetBuffer* message){
+#ifdef __linux__
+	if (netServerSocket < 0){
+		return false;
+	}
+	for (int attempt = 0; attempt < 2; attempt++){
+		NetBuffer header = {0};
+		header.length = fmin(netStreamLength, 5);
+		memcpy(header.data, netStream, header.length);
+		unsigned int length = netReadVarint(&header);
+
+		if (!header.isBroken && length > NET_MESSAGE_SIZE){
+			TraceLog(LOG_WARNING, "NET: Message too large, disconnecting");
+			stopNetwork();
+			return false;
+		}
+		if (!header.isBroken && header.position + (int)length <= netStreamLength){
+			memcpy(message->data, netStream + header.position, length);
+			message->length = length;
+			message->position = 0;
+			message->isBroken = false;
+			netStreamLength -= header.position + length;
+			memmove(netStream, netStream + header.position + length, netStreamLength);
+			return true;
+		}
+
+		if (attempt == 0){
+			ssize_t count = recv(netServerSocket, netStream + netStreamLength, NET_STREAM_SIZE - netStreamLength, MSG_DONTWAIT);
+			if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK)){
+				TraceLog(LOG_WARNING, "NET: Server closed the connection");
+				stopNetwork();
+				return false;
+			}
+			netStreamLength += fmax(count, 0);
+		}
+	}
+#endif
+	return false;
+}
+
+//------------------------------------------------------
+// hot reload
+//------------------------------------------------------
+// a watcher thread decodes changed files from RESOURCE_DIRECTORY into CPU memory,
+// the main thread uploads and swaps them between frames while the simulation is parked
+#define MAX_WATCHED_ASSETS 16
+#define ASSET_PATH_LENGTH 128
+#define ASSET_SPRITESHEET 0
+#define ASSET_SOUND 1
+
+struct WatchedAsset{
+	int type;
+	char path[ASSET_PATH_LENGTH];
+	Sound* sound;
+	bool isStaged;
+	Image stagedImage;
+	Wave stagedWave;
+};
+typedef struct WatchedAsset WatchedAsset;
+
+WatchedAsset watchedAssets[MAX_WATCHED_ASSETS];
+int watchedAssetCount = 0;
+pthread_mutex_t assetMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_t assetThread;
+atomic_bool assetWatcherRunning = false;
+
+// seconds the last asset took to decode on the watcher thread and to swap in on the main thread
+double fAssetLoadTime = 0.0;
+double fAssetSwapTime = 0.0;
+
+void watchAsset(int type, const char* path, Sound* sound){
+	if (watchedAssetCount >= MAX_WATCHED_ASSETS){
+		return;
+	}
+	WatchedAsset* asset = &watchedAssets[watchedAssetCount++];
+	memset(asset, 0, sizeof(WatchedAsset));
+	asset->type = type;
+	asset->sound = sound;
+	strncpy(asset->path, path, ASSET_PATH_LENGTH - 1);
+}
+
+// LoadSound that picks up changes to the file while the game runs
+Sound fLoadSound(Sound* target, const char* path){
+	*target = LoadSound(path);
+	watchAsset(ASSET_SOUND, path, target);
+	return *target;
+}
+
+void stageAsset(WatchedAsset* asset){
+	double start = fNow();
+	Image image = {0};
+	Wave wave = {0};
+
+	if (asset->type == ASSET_SPRITESHEET){
+		image = LoadImage(asset->path);
+		if (image.data == NULL){
+			return;
+		}
+		ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+	}else {
+		wave = LoadWave(asset->path);
+		if (wave.data == NULL){
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&assetMutex);
+	if (asset->isStaged){
+		// superseded before it was swapped in
+		UnloadImage(asset->stagedImage);
+		UnloadWave(asset->stagedWave);
+	}
+	asset->stagedImage = image;
+	asset->stagedWave = wave;
+	asset->isStaged = true;
+	fAssetLoadTime = fNow() - start;
+	pthread_mutex_unlock(&assetMutex);
+
+	TraceLog(LOG_INFO, "HOTRELOAD: Decoded %s", asset->path);
+}
+
+#ifdef __linux__
+void* assetWatcherMain(void* arg){
+	int fd = inotify_init1(IN_NONBLOCK);
+	if (fd < 0 || inotify_add_watch(fd, RESOURCE_DIRECTORY, IN_CLOSE_WRITE | IN_MOVED_TO) < 0){
+		TraceLog(LOG_WARNING, "HOTRELOAD: Can't watch %s", RESOURCE_DIRECTORY);
+		if (fd >= 0){
+			close(fd);
+		}
+		return NULL;
+	}
+
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pollFd = {fd, POLLIN, 0};
+	while (assetWatcherRunning){
+		// wake up now and then to notice shutdown
+		if (poll(&pollFd, 1, 100) <= 0){
+			continue;
+		}
+
+		ssize_t length = read(fd, buffer, sizeof(buffer));
+		for (char* p = buffer; length > 0 && p < buffer + length;){
+			struct inotify_event* event = (struct inotify_event*)p;
+			p += sizeof(struct inotify_event) + event->len;
+			if (event->len == 0){
+				continue;
+			}
+
+			for (int i = 0; i < watchedAssetCount; i++){
+				const char* name = strrchr(watchedAssets[i].path, '/');
+				if (strcmp(name != NULL ? name + 1 : watchedAssets[i].path, event->name) == 0){
+					stageAsset(&watchedAssets[i]);
+				}
+			}
+		}
+	}
+
+	close(fd);
+	return NULL;
+}
+#endif
+
+void startAssetWatcher(){
+#ifdef __linux__
+	assetWatcherRunning = true;
+	pthread_create(&assetThread, NULL, assetWatcherMain, NULL);
+#endif
+}
+
+void stopAssetWatcher(){
+#ifdef __linux__
+	assetWatcherRunning = false;
+	pthread_join(assetThread, NULL);
+#endif
+}
+
+void swapAsset(WatchedAsset* asset, Image image, Wave wave){
+	if (asset->type == ASSET_SPRITESHEET){
+		if (fHeadless){
+			UnloadImage(softwareSheet);
+			softwareSheet = image;
+			return;
+		}
+		Texture2D texture = LoadTextureFromImage(image);
+		UnloadImage(image);
+		UnloadTexture(loadedSheet.spriteSheetTexture);
+		loadedSheet.spriteSheetTexture = texture;
+	}else {
+		Sound sound = LoadSoundFromWave(wave);
+		UnloadWave(wave);
+		UnloadSound(*asset->sound);
+		*asset->sound = sound;
+	}
+}
+
+// main thread only, between frames, true if anything was swapped in
+bool applyReloadedAssets(){
+	bool hasSwapped = false;
+	for (int i = 0; i < watchedAssetCount; i++){
+		WatchedAsset* asset = &watchedAssets[i];
+
+		pthread_mutex_lock(&assetMutex);
+		bool isStaged = asset->isStaged;
+		Image image = asset->stagedImage;
+		Wave wave = asset->stagedWave;
+		asset->isStaged = false;
+		fTelemetry.assetLoadTime = fAssetLoadTime;
+		pthread_mutex_unlock(&assetMutex);
+
+		if (isStaged){
+			double start = fNow();
+			swapAsset(asset, image, wave);
+			fAssetSwapTime = fNow() - start;
+			fTelemetry.assetSwapTime = fAssetSwapTime;
+			hasSwapped = true;
+		}
+	}
+	return hasSwapped;
+}
+
+//------------------------------------------------------
+// main loop
+//------------------------------------------------------
+// raylib's GL context and input belong to the thread that opened the window,
+// so frames are simulated on a worker thread while the main thread presents the previous one
+void (*tickCallback)();
+void (*drawCallback)(float alpha);
+bool (*restCallback)();
+pthread_t simThread;
+pthread_mutex_t frameMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t frameCond = PTHREAD_COND_INITIALIZER;
+int requestedFrames = 0;
+int finishedFrames = 0;
+bool simRunning = false;
+// written by the simulation thread, read by the main thread between frames
+bool simDrawRequested = true;
+int simRestingFrames = 0;
+
+// seconds spent simulating and recording the last frame, in its last tick, in the last replay
+// and in the whole last presented frame before pacing
+double fSimTime = 0.0;
+double fTickTime = 0.0;
+double fRenderTime = 0.0;
+double fFrameTime = 0.0;
+bool fIsIdle = false;
+
+double tickAccumulator = 0.0;
+double lastFrameStart = 0.0;
+
+void fTick(){
+	double start = fNow();
 	updateCamera();
 	fTimer++;
+	tickCallback();
+	memset(keysPressed, 0, sizeof(keysPressed));
+	fTickTime = fNow() - start;
 }
 
-void fDrawEnd(){
-	EndMode2D();
-    EndTextureMode();
-    
-    BeginDrawing();
-    ClearBackground(BLACK);
-    Rectangle r = { 0, 0, (float)(renderTexture.texture.width), (float)(-renderTexture.texture.height) };
-    Rectangle r2 = { renderTextureOffset, 0, (float)(GetScreenWidth()) * scalingFactor, (float)(GetScreenHeight()) };
-    Vector2 v = {0, 0};
-    DrawTexturePro(renderTexture.texture,r,r2,v,0,WHITE);
+// runs as many fixed ticks as real time asks for, headless runs tick once per frame as fast as they can
+void simulateFrame(){
+	double now = fNow();
+	float alpha = 1.0f;
 
-    EndDrawing();
+	if (fHeadless){
+		fTick();
+	}else {
+		tickAccumulator = fmin(tickAccumulator + now - lastFrameStart, MAX_TICKS_PER_FRAME * TICK_TIME);
+		lastFrameStart = now;
+		while (tickAccumulator >= TICK_TIME){
+			fTick();
+			tickAccumulator -= TICK_TIME;
+		}
+		alpha = tickAccumulator / TICK_TIME;
+	}
+
+	if (simDrawRequested){
+		drawCallback(alpha);
+	}
+
+	bool atRest = screenShakeAmmount == 0 && restCallback != NULL && restCallback();
+	simRestingFrames = atRest ? simRestingFrames + 1 : 0;
 }
 
-void drawFancyText(const char* text, int x, int y, int scale, Color color){
-	int shadowOffset = fmax(scale / 10.0f, 1);
-	DrawText(text, x + shadowOffset, y, scale, GRAY);
-	DrawText(text, x, y, scale, color);
+void* simThreadMain(void* arg){
+	int frame = 0;
+	while (true){
+		pthread_mutex_lock(&frameMutex);
+		while (simRunning && requestedFrames == frame){
+			pthread_cond_wait(&frameCond, &frameMutex);
+		}
+		if (!simRunning){
+			pthread_mutex_unlock(&frameMutex);
+			break;
+		}
+		pthread_mutex_unlock(&frameMutex);
+
+		double start = fNow();
+		simulateFrame();
+		fSimTime = fNow() - start;
+
+		pthread_mutex_lock(&frameMutex);
+		frame++;
+		finishedFrames = frame;
+		pthread_cond_broadcast(&frameCond);
+		pthread_mutex_unlock(&frameMutex);
+	}
+	return NULL;
+}
+
+void startSimFrame(){
+	pthread_mutex_lock(&frameMutex);
+	requestedFrames++;
+	pthread_cond_broadcast(&frameCond);
+	pthread_mutex_unlock(&frameMutex);
+}
+
+void waitSimFrame(){
+	pthread_mutex_lock(&frameMutex);
+	while (finishedFrames < requestedFrames){
+		pthread_cond_wait(&frameCond, &frameMutex);
+	}
+	pthread_mutex_unlock(&frameMutex);
+}
+
+// absolute deadline so wakeups don't drift, and the thread sleeps instead of spinning
+void sleepUntil(double deadline){
+	struct timespec t;
+	t.tv_sec = deadline;
+	t.tv_nsec = (deadline - t.tv_sec) * 1000000000.0;
+	// only a signal cuts the sleep short, anything else would fail again on retry
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR){
+	}
+}
+
+bool hasInput(){
+	for (int i = 0; i < F_MAX_KEYS; i++){
+		if (keysDown[i] || keysPressed[i]){
+			return true;
+		}
+	}
+	return false;
+}
+
+void updateFrameTelemetry(int frames){
+	fTelemetry.ticks = fTimer;
+	fTelemetry.frames = frames;
+	fTelemetry.frameTime = fFrameTime;
+	fTelemetry.simTime = fSimTime;
+	fTelemetry.tickTime = fTickTime;
+	fTelemetry.renderTime = fRenderTime;
+	fTelemetry.isIdle = fIsIdle;
+	publishTelemetry();
+}
+
+// rest decides when the game has settled, the framework then stops redrawing until input arrives
+void fRun(void (*tick)(), void (*draw)(float alpha), bool (*rest)()){
+	tickCallback = tick;
+	drawCallback = draw;
+	restCallback = rest;
+	lastFrameStart = fNow();
+	int refreshRate = fHeadless ? 0 : GetMonitorRefreshRate(GetCurrentMonitor());
+	double frameBudget = 1.0 / (refreshRate > 0 ? refreshRate : TICK_RATE);
+	simRunning = true;
+	pthread_create(&simThread, NULL, simThreadMain, NULL);
+
+	int frames = 0;
+	double totalRenderTime = 0.0;
+	startAssetWatcher();
+	startCaptureEncoder();
+	if (fCapturePath != NULL){
+		startCapture(fCapturePath);
+	}
+	if (fTelemetryName != NULL){
+		startTelemetry(fTelemetryName);
+	}
+	if (fServePort != 0){
+		startServer(fServePort);
+	}
+	if (fSpectateAddress != NULL){
+		connectToServer(fSpectateAddress);
+	}
+	while (fHeadless ? (fFrameLimit == 0 || frames < fFrameLimit) : !WindowShouldClose()){
+		double frameStart = fNow();
+		if (!fHeadless){
+			captureInput();
+			if (IsKeyPressed(KEY_F9)){
+				toggleCapture();
+			}
+		}
+		if (applyReloadedAssets()){
+			// the simulation is parked between frames, wake it so the new art gets presented
+			simRestingFrames = 0;
+		}
+
+		// two settled frames so the last one recorded has been presented
+		fIsIdle = !fHeadless && simRestingFrames >= 2 && !hasInput();
+		simDrawRequested = !fIsIdle;
+		startSimFrame();
+
+		if (fIsIdle){
+			// keep ticking for music and timers, but leave the GPU alone
+			waitSimFrame();
+			updateFrameTelemetry(frames);
+			PollInputEvents();
+			sleepUntil(frameStart + IDLE_POLL_TIME);
+			continue;
+		}
+
+		double start = fNow();
+		if (fHeadless){
+			softwareReplayDrawList(&drawLists[!recordingList]);
+			captureSoftwareFramebuffer();
+		}else {
+			replayDrawList(&drawLists[!recordingList]);
+		}
+		fRenderTime = fNow() - start;
+		totalRenderTime += fRenderTime;
+		frames++;
 
+		waitSimFrame();
+		recordingList = !recordingList;
+
+		fFrameTime = fNow() - frameStart;
+		updateFrameTelemetry(frames);
+		if (!fHeadless){
+			sleepUntil(frameStart + frameBudget);
+		}
+	}
+
+	if (fHeadless && frames > 0){
+		TraceLog(LOG_INFO, "HEADLESS: %i frames, %.3f ms render per frame (%.0f fps)", frames,
+			totalRenderTime * 1000.0 / frames, frames / totalRenderTime);
+	}
+
+	pthread_mutex_lock(&frameMutex);
+	simRunning = false;
+	pthread_cond_broadcast(&frameCond);
+	pthread_mutex_unlock(&frameMutex);
+	pthread_join(simThread, NULL);
+	stopAssetWatcher();
+	stopCapture();
+	stopCaptureEncoder();
+	stopTelemetry();
+	stopNetwork();
 }
 
 //------------------------------------------------------
 // init
 //------------------------------------------------------
-void initFramework(){
+// --headless             render on the CPU without opening a window
+// --frames <n>           stop after n frames
+// --png <directory>      write every headless frame as a png
+// --hash                 print a hash of every headless frame for golden image tests
+// --seed <n>             fixed random seed
+// --capture <file.y4m>   record every presented frame, F9 toggles recording in a window
+// --telemetry [name]     publish live counters to a shared memory segment, see telemetry.h
+// --serve [port]         stream the game to spectators over TCP
+// --spectate <host[:port]> watch a game started with --serve
+// --no-effects           drop sounds, popups, particles and screen shake
+void fParseArguments(int argc, char** argv){
+	for (int i = 1; i < argc; i++){
+		bool hasValue = i + 1 < argc;
+		if (strcmp(argv[i], "--headless") == 0){
+			fHeadless = true;
+		}else if (strcmp(argv[i], "--frames") == 0 && hasValue){
+			fFrameLimit = atoi(argv[++i]);
+		}else if (strcmp(argv[i], "--png") == 0 && hasValue){
+			fFrameDirectory = argv[++i];
+		}else if (strcmp(argv[i], "--hash") == 0){
+			fPrintFrameHashes = true;
+		}else if (strcmp(argv[i], "--capture") == 0 && hasValue){
+			fCapturePath = argv[++i];
+		}else if (strcmp(argv[i], "--seed") == 0 && hasValue){
+			fHasRandomSeed = true;
+			fRandomSeed = atoi(argv[++i]);
+		}else if (strcmp(argv[i], "--telemetry") == 0){
+			fTelemetryName = hasValue && argv[i + 1][0] == '/' ? argv[++i] : TELEMETRY_DEFAULT_NAME;
+		}else if (strcmp(argv[i], "--serve") == 0){
+			fServePort = hasValue && atoi(argv[i + 1]) > 0 ? atoi(argv[++i]) : NET_DEFAULT_PORT;
+		}else if (strcmp(argv[i], "--spectate") == 0 && hasValue){
+			fSpectateAddress = argv[++i];
+		}else if (strcmp(argv[i], "--no-effects") == 0){
+			fEffectsEnabled = false;
+		}else {
+			TraceLog(LOG_WARNING, "FRAMEWORK: Unknown argument %s", argv[i]);
+		}
+	}
+}
+
+void initHeadlessFramework(){
+	softwareSheet = LoadImage(SPRITESHEET_PATH);
+	ImageFormat(&softwareSheet, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+	loadedSheet.width = softwareSheet.width / DEFAULT_SPRITE_SIZE;
+	loadedSheet.height = softwareSheet.height / DEFAULT_SPRITE_SIZE;
+	softwareFramebuffer = calloc(SOFTWARE_WIDTH * SOFTWARE_HEIGHT, 4);
+}
+
+void initWindowFramework(){
 	InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, WINDOW_NAME);
-	SetTargetFPS(60);
+	// fRun paces frames itself
+	SetTargetFPS(0);
 	renderTexture = LoadRenderTexture(SCREEN_WIDTH, SCREEN_HEIGHT);
 	loadedSheet = initSpriteSheet();
 	scalingFactor = SCREEN_WIDTH /(float)(GetScreenWidth());
 	renderTextureOffset = ((GetScreenWidth()) / 2) - (SCREEN_WIDTH / 2);
 	ToggleFullscreen();
+}
+
+void initFramework(){
+	if (fHeadless){
+		initHeadlessFramework();
+	}else {
+		initWindowFramework();
+	}
+	watchAsset(ASSET_SPRITESHEET, SPRITESHEET_PATH, NULL);
+
 	cam.zoom = DEFAULT_CAMERA_ZOOM;
+	drawLists[0].camera = cam;
+	drawLists[1].camera = cam;
+	if (fHasRandomSeed){
+		SetRandomSeed(fRandomSeed);
+	}
 }
 
 //------------------------------------------------------
 // dispose
 //------------------------------------------------------
 void disposeFramework(){
+	if (fHeadless){
+		UnloadImage(softwareSheet);
+		free(softwareFramebuffer);
+		return;
+	}
 	CloseWindow();
 	unloadSpriteSheet(loadedSheet);
 	UnloadRenderTexture(renderTexture);
@@ -0,0 +1,42 @@
+#ifndef G_TELEMETRY
+#define G_TELEMETRY
+
+#include <stdatomic.h>
+//------------------------------------------------------
+// Telemetry layout
+//------------------------------------------------------
+// shared memory segment published with --telemetry, read by telemetryReader.c
+#define TELEMETRY_DEFAULT_NAME "/gameska-telemetry"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_ORE_TYPES 16
+
+struct TelemetryCounters{
+	// framework
+	unsigned long long ticks;
+	unsigned long long frames;
+	double frameTime;
+	double simTime;
+	double tickTime;
+	double renderTime;
+	double assetLoadTime;
+	double assetSwapTime;
+	unsigned long long soundsPlayed;
+	int isIdle;
+	// game
+	int depth;
+	int particleCount;
+	int popupCount;
+	unsigned long long rowsGenerated;
+	unsigned long long tilesMined[TELEMETRY_ORE_TYPES];
+};
+typedef struct TelemetryCounters TelemetryCounters;
+
+// seqlock, sequence is odd while the game is copying counters in
+struct TelemetrySegment{
+	unsigned int version;
+	atomic_uint sequence;
+	TelemetryCounters counters;
+};
+typedef struct TelemetrySegment TelemetrySegment;
+
+#endif
@@ -0,0 +1,75 @@
+// samples the counters a game started with --telemetry publishes
+// cc telemetryReader.c -o telemetryReader -lrt
+// ./telemetryReader [name] [interval ms]
+#include "telemetry.h"
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_READ_ATTEMPTS 1000
+
+// copies the counters out once the game isn't in the middle of writing them
+bool readCounters(const TelemetrySegment* segment, TelemetryCounters* out){
+	for (int i = 0; i < MAX_READ_ATTEMPTS; i++){
+		unsigned int before = atomic_load_explicit(&segment->sequence, memory_order_acquire);
+		if (before & 1){
+			continue;
+		}
+		*out = segment->counters;
+		atomic_thread_fence(memory_order_acquire);
+		unsigned int after = atomic_load_explicit(&segment->sequence, memory_order_relaxed);
+		if (before == after){
+			return true;
+		}
+	}
+	return false;
+}
+
+void printCounters(const TelemetryCounters* c){
+	printf("tick %llu frame %llu%s | frame %.2f sim %.2f tick %.3f render %.2f ms | depth %i rows %llu | particles %i popups %i | sounds %llu | asset load %.2f swap %.2f ms | mined",
+		c->ticks, c->frames, c->isIdle ? " idle" : "",
+		c->frameTime * 1000.0, c->simTime * 1000.0, c->tickTime * 1000.0, c->renderTime * 1000.0,
+		c->depth, c->rowsGenerated, c->particleCount, c->popupCount, c->soundsPlayed,
+		c->assetLoadTime * 1000.0, c->assetSwapTime * 1000.0);
+	for (int i = 0; i < TELEMETRY_ORE_TYPES; i++){
+		if (c->tilesMined[i] > 0){
+			printf(" %i:%llu", i, c->tilesMined[i]);
+		}
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+int main(int argc, char** argv){
+	const char* name = argc > 1 ? argv[1] : TELEMETRY_DEFAULT_NAME;
+	int interval = argc > 2 ? atoi(argv[2]) : 500;
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0){
+		fprintf(stderr, "can't open %s, is the game running with --telemetry?\n", name);
+		return 1;
+	}
+	const TelemetrySegment* segment = mmap(NULL, sizeof(TelemetrySegment), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment == MAP_FAILED){
+		fprintf(stderr, "can't map %s\n", name);
+		return 1;
+	}
+	if (segment->version != TELEMETRY_VERSION){
+		fprintf(stderr, "%s has layout version %u, expected %i\n", name, segment->version, TELEMETRY_VERSION);
+		return 1;
+	}
+
+	struct timespec sleepTime = {interval / 1000, (interval % 1000) * 1000000L};
+	while (true){
+		TelemetryCounters counters;
+		if (readCounters(segment, &counters)){
+			printCounters(&counters);
+		}
+		nanosleep(&sleepTime, NULL);
+	}
+}